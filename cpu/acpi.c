@@ -0,0 +1,270 @@
+#include "smp.h"
+#include "lapic.h"
+#include "errno.h"
+#include "string.h"
+
+// Reference: https://wiki.osdev.org/RSDP, https://wiki.osdev.org/MADT
+struct acpi_rsdp
+{
+    char signature[8]; // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+} __attribute__((packed));
+
+struct acpi_sdt_header
+{
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct acpi_madt
+{
+    struct acpi_sdt_header header; // "APIC"
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed));
+
+#define MADT_PROCESSOR 0
+#define MADT_IOAPIC 1
+#define MADT_INTERRUPT_OVERRIDE 2
+
+// Reference: Intel MultiProcessor Specification 1.4, chapter 4
+struct mp_floating_pointer
+{
+    char signature[4]; // "_MP_"
+    uint32_t config_address;
+    uint8_t length; // In 16 byte units
+    uint8_t revision;
+    uint8_t checksum;
+    uint8_t features[5];
+} __attribute__((packed));
+
+struct mp_config_header
+{
+    char signature[4]; // "PCMP"
+    uint16_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_address;
+    uint16_t extended_length;
+    uint8_t extended_checksum;
+    uint8_t reserved;
+} __attribute__((packed));
+
+#define MP_PROCESSOR 0
+#define MP_BUS 1
+#define MP_IOAPIC 2
+#define MP_IO_INTERRUPT 3
+#define MP_INTERRUPT_INT 0 // Vectored interrupt, the others are NMI, SMI and ExtINT
+#define MP_MAX_BUSES 32
+#define MP_PROCESSOR_ENTRY_SIZE 20
+#define MP_ENTRY_SIZE 8
+
+static uint8_t checksum(const void* data, uint32_t length)
+{
+    const uint8_t* bytes = data;
+    uint8_t sum = 0;
+    for(uint32_t i = 0; i < length; i++)
+    {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+/**
+ * @brief Find a structure on a 16 byte boundary whose first length bytes sum to 0
+ * @return Its address, 0 if there is none
+ */
+static void* scan_memory(uint32_t start, uint32_t size, const char* signature, int signature_len, uint32_t length)
+{
+    for(uint32_t address = start; address + length <= start + size; address += 16)
+    {
+        if(memcmp((void*)address, signature, signature_len) == 0 && checksum((void*)address, length) == 0)
+        {
+            return (void*)address;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Search the first KB of the EBDA, then the BIOS area below 1MB
+ */
+static void* scan_bios_areas(const char* signature, int signature_len, uint32_t length)
+{
+    uint32_t ebda = (uint32_t)(*(uint16_t*)0x40E) << 4;
+    void* found = 0;
+    if(ebda)
+    {
+        found = scan_memory(ebda, 1024, signature, signature_len, length);
+    }
+    if(!found)
+    {
+        found = scan_memory(0xE0000, 0x20000, signature, signature_len, length);
+    }
+    return found;
+}
+
+// ISA IRQs are identity mapped, active high and edge triggered unless the firmware says otherwise
+static void init_config(struct smp_config* config)
+{
+    memset(config, 0x00, sizeof(struct smp_config));
+    for(int irq = 0; irq < ISA_IRQS; irq++)
+    {
+        config->irq_gsi[irq] = irq;
+    }
+}
+
+static void add_cpu(struct smp_config* config, uint8_t apic_id)
+{
+    if(config->total_cpus < MAX_CPUS)
+    {
+        config->apic_ids[config->total_cpus ++] = apic_id;
+    }
+}
+
+/**
+ * @brief Read the CPUs and the IOAPIC from the MADT of the ACPI tables
+ * @return 0 if success, -EIO if there is no valid RSDP, RSDT or MADT
+ */
+int acpi_read_madt(struct smp_config* config)
+{
+    init_config(config);
+    struct acpi_rsdp* rsdp = scan_bios_areas("RSD PTR ", 8, sizeof(struct acpi_rsdp));
+    if(!rsdp)
+    {
+        return -EIO;
+    }
+
+    struct acpi_sdt_header* rsdt = (struct acpi_sdt_header*)rsdp->rsdt_address;
+    if(memcmp(rsdt->signature, "RSDT", 4) != 0 || checksum(rsdt, rsdt->length) != 0)
+    {
+        return -EIO;
+    }
+
+    struct acpi_madt* madt = 0;
+    uint32_t* tables = (uint32_t*)(rsdt + 1);
+    int total_tables = (rsdt->length - sizeof(struct acpi_sdt_header)) / 4;
+    for(int i = 0; i < total_tables && !madt; i++)
+    {
+        struct acpi_sdt_header* table = (struct acpi_sdt_header*)tables[i];
+        if(memcmp(table->signature, "APIC", 4) == 0 && checksum(table, table->length) == 0)
+        {
+            madt = (struct acpi_madt*)table;
+        }
+    }
+
+    if(!madt)
+    {
+        return -EIO;
+    }
+
+    config->lapic_address = madt->lapic_address ? madt->lapic_address : LAPIC_DEFAULT_BASE;
+    uint8_t* entry = (uint8_t*)(madt + 1);
+    uint8_t* end = (uint8_t*)madt + madt->header.length;
+    while(entry + 2 <= end && entry[1] >= 2)
+    {
+        switch(entry[0])
+        {
+            case MADT_PROCESSOR: // acpi id, apic id, flags(bit 0: enabled)
+                if(entry[4] & 0x01)
+                {
+                    add_cpu(config, entry[3]);
+                }
+                break;
+
+            case MADT_IOAPIC: // ioapic id, reserved, address, global system interrupt base
+                if(!config->ioapic_address)
+                {
+                    config->ioapic_id = entry[2];
+                    config->ioapic_address = *(uint32_t*)(entry + 4);
+                    config->ioapic_gsi_base = *(uint32_t*)(entry + 8);
+                }
+                break;
+
+            case MADT_INTERRUPT_OVERRIDE: // bus(0: ISA), source IRQ, global system interrupt, flags
+                if(entry[2] == 0 && entry[3] < ISA_IRQS)
+                {
+                    config->irq_gsi[entry[3]] = *(uint32_t*)(entry + 4);
+                    config->irq_flags[entry[3]] = *(uint16_t*)(entry + 8);
+                }
+                break;
+        }
+        entry += entry[1];
+    }
+
+    return config->total_cpus ? 0 : -EIO;
+}
+
+/**
+ * @brief Read the CPUs and the IOAPIC from the Intel MP table, for firmware without ACPI
+ * @return 0 if success, -EIO if there is no valid MP configuration table
+ */
+int mp_read_table(struct smp_config* config)
+{
+    init_config(config);
+    struct mp_floating_pointer* pointer = scan_bios_areas("_MP_", 4, sizeof(struct mp_floating_pointer));
+    if(!pointer || !pointer->config_address)
+    {
+        return -EIO; // A default configuration(features[0] != 0) has no table to read
+    }
+
+    struct mp_config_header* header = (struct mp_config_header*)pointer->config_address;
+    if(memcmp(header->signature, "PCMP", 4) != 0 || checksum(header, header->length) != 0)
+    {
+        return -EIO;
+    }
+
+    config->lapic_address = header->lapic_address ? header->lapic_address : LAPIC_DEFAULT_BASE;
+    bool isa_bus[MP_MAX_BUSES];
+    memset(isa_bus, 0x00, sizeof(isa_bus));
+    uint8_t* entry = (uint8_t*)(header + 1);
+    for(int i = 0; i < header->entry_count; i++)
+    {
+        if(entry[0] == MP_PROCESSOR)
+        {
+            if(entry[3] & 0x01) // Enabled
+            {
+                add_cpu(config, entry[1]);
+            }
+            entry += MP_PROCESSOR_ENTRY_SIZE;
+            continue;
+        }
+
+        if(entry[0] == MP_BUS && entry[1] < MP_MAX_BUSES) // bus id, type string
+        {
+            isa_bus[entry[1]] = memcmp(entry + 2, "ISA", 3) == 0;
+        }
+
+        if(entry[0] == MP_IOAPIC && (entry[3] & 0x01) && !config->ioapic_address)
+        {
+            config->ioapic_id = entry[1];
+            config->ioapic_address = *(uint32_t*)(entry + 4);
+        }
+
+        // type, flags, source bus, source IRQ, destination IOAPIC, destination pin; the bus entries come first
+        if(entry[0] == MP_IO_INTERRUPT && entry[1] == MP_INTERRUPT_INT && entry[4] < MP_MAX_BUSES && isa_bus[entry[4]]
+           && entry[5] < ISA_IRQS && entry[6] == config->ioapic_id)
+        {
+            config->irq_gsi[entry[5]] = entry[7];
+            config->irq_flags[entry[5]] = *(uint16_t*)(entry + 2);
+        }
+        entry += MP_ENTRY_SIZE;
+    }
+
+    return config->total_cpus ? 0 : -EIO;
+}
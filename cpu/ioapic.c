@@ -0,0 +1,62 @@
+#include "ioapic.h"
+
+static volatile uint32_t* ioapic_base;
+static int total_pins;
+
+static uint32_t ioapic_read(uint32_t reg)
+{
+    ioapic_base[IOAPIC_REGSEL / 4] = reg;
+    return ioapic_base[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t value)
+{
+    ioapic_base[IOAPIC_REGSEL / 4] = reg;
+    ioapic_base[IOAPIC_WINDOW / 4] = value;
+}
+
+/**
+ * @brief Take over the IOAPIC at address with every pin masked, pins are enabled one by one with ioapic_set_pin()
+ */
+void ioapic_init(uint32_t address)
+{
+    ioapic_base = (volatile uint32_t*)address;
+    total_pins = ((ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+    for(int pin = 0; pin < total_pins; pin++)
+    {
+        ioapic_mask_pin(pin);
+    }
+}
+
+int ioapic_total_pins()
+{
+    return total_pins;
+}
+
+/**
+ * @brief Deliver a pin as vector to one local APIC
+ * @param flags The MPS INTI flags of the source, ISA interrupts are active high and edge triggered unless overridden
+ */
+void ioapic_set_pin(uint32_t pin, uint8_t vector, uint16_t flags, uint8_t apic_id)
+{
+    uint32_t low = vector; // Fixed delivery, physical destination
+    if((flags & IRQ_FLAGS_ACTIVE_LOW) == IRQ_FLAGS_ACTIVE_LOW)
+    {
+        low |= IOAPIC_PIN_ACTIVE_LOW;
+    }
+    if((flags & IRQ_FLAGS_LEVEL) == IRQ_FLAGS_LEVEL)
+    {
+        low |= IOAPIC_PIN_LEVEL;
+    }
+
+    // Mask while the destination changes, then write the low word last to unmask
+    ioapic_write(IOAPIC_REDIRECTION + pin * 2, IOAPIC_PIN_MASKED);
+    ioapic_write(IOAPIC_REDIRECTION + pin * 2 + 1, (uint32_t)apic_id << 24);
+    ioapic_write(IOAPIC_REDIRECTION + pin * 2, low);
+}
+
+void ioapic_mask_pin(uint32_t pin)
+{
+    ioapic_write(IOAPIC_REDIRECTION + pin * 2, IOAPIC_PIN_MASKED);
+    ioapic_write(IOAPIC_REDIRECTION + pin * 2 + 1, 0);
+}
@@ -0,0 +1,106 @@
+#include "lapic.h"
+#include "clock.h"
+#include "config.h"
+
+// The local APIC registers are 32 bit wide and 16 byte aligned, identity mapped by the kernel page directory
+static volatile uint8_t* lapic_base;
+static uint32_t timer_counts; // Initial count of the local timer for one tick at CLOCK_TICK_HZ, 0 until calibrated
+
+/**
+ * @brief Remember where the local APIC registers are, the address is the same on every CPU
+ */
+void lapic_init(uint32_t base)
+{
+    lapic_base = (volatile uint8_t*)base;
+}
+
+bool lapic_present()
+{
+    return lapic_base != 0;
+}
+
+uint32_t lapic_read(uint32_t reg)
+{
+    return *(volatile uint32_t*)(lapic_base + reg);
+}
+
+void lapic_write(uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t*)(lapic_base + reg) = value;
+}
+
+/**
+ * @brief Software enable the local APIC of the calling CPU, spurious interrupts go to vector 0xFF
+ * The LVT entries are left as the firmware set them, LINT0 of the BSP still carries the 8259 interrupts
+ */
+void lapic_enable()
+{
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_TPR, 0); // Accept every priority
+}
+
+uint8_t lapic_id()
+{
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+/**
+ * @brief Send an IPI and wait until the local APIC has delivered it
+ * @param icr The low ICR word: vector, delivery mode and level
+ */
+void lapic_send_ipi(uint8_t apic_id, uint32_t icr)
+{
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr); // Writing the low word sends the IPI
+    while(lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING)
+    {
+    }
+}
+
+// Signal the end of the interrupt being handled, one MMIO write instead of the port I/O to both 8259s
+void lapic_eoi()
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/**
+ * @brief Measure the local timer against clock_ns() over CLOCK_CALIBRATE_MS, the rate is the same on every CPU
+ * Run on the BSP with interrupts enabled, clock_ns() counts timer interrupts if there is no TSC
+ */
+void lapic_timer_calibrate()
+{
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+
+    uint64_t end = clock_ns() + (uint64_t)CLOCK_CALIBRATE_MS * 1000000;
+    while(clock_ns() < end)
+    {
+    }
+
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    timer_counts = elapsed / CLOCK_CALIBRATE_MS * 1000 / CLOCK_TICK_HZ;
+}
+
+bool lapic_timer_calibrated()
+{
+    return timer_counts != 0;
+}
+
+/**
+ * @brief Start the local timer of the calling CPU, it interrupts CLOCK_TICK_HZ times a second
+ */
+void lapic_timer_start()
+{
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INITIAL, timer_counts);
+}
+
+void lapic_timer_handler(struct trap_frame* frame)
+{
+    lapic_eoi();
+    timer_local_tick();
+}
@@ -0,0 +1,231 @@
+#include "smp.h"
+#include "lapic.h"
+#include "ioapic.h"
+#include "interrupt.h"
+#include "clock.h"
+#include "io.h"
+#include "errno.h"
+#include "mm.h"
+#include "print.h"
+#include "string.h"
+
+extern char ap_trampoline_start[];
+extern char ap_trampoline_end[];
+extern char ap_trampoline_cr3[];
+extern char ap_trampoline_stack[];
+extern char ap_trampoline_cpu[];
+
+static struct cpu cpus[MAX_CPUS];
+static int total_cpus;
+static struct smp_config smp_config;
+static bool ioapic_enabled;
+
+// Address of a variable of the trampoline in its copy at SMP_TRAMPOLINE_ADDR
+static uint32_t* trampoline_variable(char* variable)
+{
+    return (uint32_t*)(SMP_TRAMPOLINE_ADDR + (variable - ap_trampoline_start));
+}
+
+static void delay_us(uint32_t us)
+{
+    uint64_t end = clock_ns() + (uint64_t)us * 1000;
+    while(clock_ns() < end)
+    {
+    }
+}
+
+/**
+ * @brief Give the calling CPU its own GDT, load its TSS and point %gs at its struct cpu
+ * @param esp0 The stack interrupts from ring 3 switch to
+ */
+static void cpu_setup(struct cpu* cpu, uint32_t esp0)
+{
+    cpu->self = cpu;
+    memset(&cpu->tss, 0x00, sizeof(cpu->tss));
+    cpu->tss.esp0 = esp0;
+    cpu->tss.ss0 = DATA_SELECTOR;
+
+    gdt_init_cpu(cpu->gdt, &cpu->tss, sizeof(cpu->tss), cpu, sizeof(struct cpu));
+    load_gdt(cpu->gdt, sizeof(cpu->gdt));
+    asm volatile("movw %w0, %%gs" : : "r"(PERCPU_SELECTOR));
+
+    // Index(13bit): 5(在GDT表中下标为5的条目是tss段描述符)
+    // RPL(2bit): 0
+    // TI(1bit): 0
+    // Selector(16bit): 5 << 3 + 0 = 0x28
+    load_tss(TSS_SELECTOR);
+}
+
+/**
+ * @brief Set up the boot CPU as CPU 0, before anything uses this_cpu()
+ */
+void smp_init_bsp()
+{
+    memset(cpus, 0x00, sizeof(cpus));
+    cpu_setup(&cpus[0], BOOT_THREAD_ESP0);
+    cpus[0].online = true;
+    total_cpus = 1;
+}
+
+/**
+ * @brief First C code of an AP, on its boot stack with the page directory of the BSP
+ * The AP then runs threads from its own run queue and steals from the others
+ */
+void ap_main(struct cpu* cpu)
+{
+    cpu_setup(cpu, (uint32_t)cpu->stack + SMP_AP_STACK_SIZE);
+    idt_load();
+    lapic_enable();
+    if(lapic_timer_calibrated())
+    {
+        lapic_timer_start();
+        cpu->has_timer = true;
+    }
+    cpu->online = true;
+
+    thread_init_ap();
+}
+
+/**
+ * @brief Start one AP with INIT-SIPI-SIPI and wait until it is online
+ * @return 0 if success, -ENOMEM if its stack can not be allocated, -EIO if it did not come up in SMP_AP_TIMEOUT_MS
+ */
+static int boot_ap(uint8_t apic_id)
+{
+    struct cpu* cpu = &cpus[total_cpus];
+    memset(cpu, 0x00, sizeof(struct cpu));
+    cpu->id = total_cpus;
+    cpu->apic_id = apic_id;
+    cpu->stack = kmalloc(SMP_AP_STACK_SIZE);
+    if(!cpu->stack)
+    {
+        return -ENOMEM;
+    }
+
+    *trampoline_variable(ap_trampoline_stack) = (uint32_t)cpu->stack + SMP_AP_STACK_SIZE;
+    *trampoline_variable(ap_trampoline_cpu) = (uint32_t)cpu;
+
+    // Reference: Intel MultiProcessor Specification 1.4, B.4 Application Processor Startup
+    lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL);
+    lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL);
+    delay_us(10000);
+    for(int i = 0; i < 2 && !cpu->online; i++)
+    {
+        lapic_send_ipi(apic_id, LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE_ADDR >> 12));
+        delay_us(200);
+    }
+
+    uint64_t timeout = clock_ns() + (uint64_t)SMP_AP_TIMEOUT_MS * 1000000;
+    while(!cpu->online && clock_ns() < timeout)
+    {
+    }
+
+    if(!cpu->online)
+    {
+        // INIT parks the AP in wait-for-SIPI again, it can not be on its way to ap_main() once the stack is freed
+        lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL);
+        lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL);
+        delay_us(10000);
+        kfree(cpu->stack);
+        cpu->stack = 0;
+        return -EIO;
+    }
+
+    total_cpus ++;
+    return 0;
+}
+
+/**
+ * @brief Hand the IRQs over from the 8259s to the IOAPIC and drive the scheduler from the local timer
+ * The IRQs that have handlers go to the BSP, irq_set_affinity() moves them
+ */
+static void apic_init()
+{
+    lapic_timer_calibrate(); // Still on the PIT interrupt, clock_ns() may need it
+
+    uint32_t flags = irq_save();
+    pic_disable();
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED); // The virtual wire from the 8259s
+    ioapic_init(smp_config.ioapic_address);
+    ioapic_enabled = true;
+    irq_use_apic();
+    irq_set_affinity(TIMER_IRQ, 0); // The PIT keeps counting clock ticks
+    irq_set_affinity(KEYBOARD_IRQ, 0);
+    irq_set_affinity(ATA_PRIMARY_IRQ, 0);
+
+    lapic_timer_start();
+    timer_use_local();
+    this_cpu()->has_timer = true;
+    irq_restore(flags);
+}
+
+/**
+ * @brief Find the CPUs in the ACPI MADT or the MP table and start the APs one by one
+ * Call with paging enabled, the APs use the page directory that is loaded on the BSP
+ */
+void smp_init()
+{
+    if(acpi_read_madt(&smp_config) < 0 && mp_read_table(&smp_config) < 0)
+    {
+        print("SMP: no ACPI MADT or MP table, running on one CPU\n");
+        return;
+    }
+
+    lapic_init(smp_config.lapic_address);
+    lapic_enable();
+    cpus[0].apic_id = lapic_id();
+    if(smp_config.ioapic_address)
+    {
+        apic_init();
+    }
+
+    memcpy((void*)SMP_TRAMPOLINE_ADDR, ap_trampoline_start, ap_trampoline_end - ap_trampoline_start);
+    uint32_t cr3;
+    asm volatile("movl %%cr3, %0" : "=r"(cr3));
+    *trampoline_variable(ap_trampoline_cr3) = cr3;
+
+    for(int i = 0; i < smp_config.total_cpus && total_cpus < MAX_CPUS; i++)
+    {
+        if(smp_config.apic_ids[i] == cpus[0].apic_id)
+        {
+            continue;
+        }
+
+        if(boot_ap(smp_config.apic_ids[i]) < 0)
+        {
+            print("SMP: an AP did not start\n");
+        }
+    }
+}
+
+int smp_total_cpus()
+{
+    return total_cpus;
+}
+
+struct cpu* smp_get_cpu(int id)
+{
+    return id >= 0 && id < total_cpus ? &cpus[id] : 0;
+}
+
+/**
+ * @brief Deliver an ISA IRQ to one CPU through the IOAPIC, at vector IRQ_BASE_VECTOR + irq
+ * @return 0 if success, -EINVARG if the IRQ, the CPU or its IOAPIC pin does not exist or the 8259s still deliver the IRQs
+ */
+int irq_set_affinity(int irq, int cpu_id)
+{
+    struct cpu* cpu = smp_get_cpu(cpu_id);
+    if(!ioapic_enabled || irq < 0 || irq >= ISA_IRQS || !cpu)
+    {
+        return -EINVARG;
+    }
+
+    uint32_t pin = smp_config.irq_gsi[irq] - smp_config.ioapic_gsi_base;
+    if(pin >= (uint32_t)ioapic_total_pins())
+    {
+        return -EINVARG;
+    }
+
+    ioapic_set_pin(pin, IRQ_BASE_VECTOR + irq, smp_config.irq_flags[irq], cpu->apic_id);
+    return 0;
+}
@@ -5,8 +5,80 @@
 #include "string.h"
 #include "vfs.h"
 #include "mm.h"
+#include "print.h"
+#include "thread.h"
+#include "interrupt.h"
+
+#define MBR_PARTITION_TABLE_OFFSET 446
+#define MBR_SIGNATURE_OFFSET 510
+#define MBR_SIGNATURE 0xAA55
+#define MBR_TYPE_EMPTY 0x00
+
+#define ATA_STATUS_ERR 0x01
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_BSY 0x80
+
+// An entry of the partition table in the MBR or in an extended boot record
+struct mbr_partition_entry
+{
+    unsigned char status; // 0x80 bootable, 0x00 otherwise
+    unsigned char chs_first[3];
+    unsigned char type;
+    unsigned char chs_last[3];
+    unsigned int lba_first;
+    unsigned int sectors;
+} __attribute__((packed));
 
 struct disk disk; // Primary hard disk
+struct disk memory_disk; // Drive of the tmpfs
+struct disk partitions[MAX_PARTITIONS]; // Partitions of the primary hard disk
+static int total_partitions;
+static struct mutex ata_lock; // One command at a time on the primary ATA channel
+static struct wait_queue ata_wait; // The thread waiting for the drive, woken by IRQ 14
+
+/**
+ * @brief The drive is not busy and either reports an error or (status & mask) == value
+ * The other status bits are only valid once BSY is clear
+ */
+static bool ata_status_done(unsigned char status, unsigned char mask, unsigned char value)
+{
+    return !(status & ATA_STATUS_BSY) && ((status & ATA_STATUS_ERR) || (status & mask) == value);
+}
+
+/**
+ * @brief Sleep until the drive raises IRQ 14 with the wanted status
+ * Only for states the drive announces with an interrupt, see poll_disk_status()
+ * @return The last status read
+ */
+static unsigned char wait_disk_status(unsigned char mask, unsigned char value)
+{
+    unsigned char status;
+    wait_event(&ata_wait, ata_status_done(status = inb(0x1F7), mask, value));
+    return status;
+}
+
+/**
+ * @brief Yield until the drive has the wanted status, for the first DRQ of a write that raises no interrupt
+ * @return The last status read
+ */
+static unsigned char poll_disk_status(unsigned char mask, unsigned char value)
+{
+    unsigned char status = inb(0x1F7);
+    while (!ata_status_done(status, mask, value))
+    {
+        thread_yield();
+        status = inb(0x1F7);
+    }
+    return status;
+}
+
+// Reading the status acknowledges the interrupt of the drive, the waiter reads the status itself
+static void ata_interrupt_handler(struct trap_frame* frame)
+{
+    inb(0x1F7);
+    irq_eoi(ATA_PRIMARY_IRQ);
+    wake_up(&ata_wait);
+}
 
 /**
  * LBA:Linear Block Address
@@ -35,14 +107,12 @@ int read_disk_sector(int lba, int total, void* buf)
     unsigned short* ptr = (unsigned short*) buf; // Read two bytes at a time
     for (int b = 0; b < total; b++)
     {
-        // Wait for the disk to be ready
         // PIO data transfer is done by the CPU, so we need to wait for the disk to be ready
-        char status = inb(0x1F7);
-        //int cnt = 0;
-        while (!(status & 0x08))
+        // The drive raises IRQ 14 once a sector is in its buffer, other threads run while it seeks
+        unsigned char status = wait_disk_status(ATA_STATUS_BSY | ATA_STATUS_DRQ, ATA_STATUS_DRQ);
+        if (status & ATA_STATUS_ERR)
         {
-            status = inb(0x1F7);
-            
+            return -EIO;
         }
 
         for (int i = 0; i < 256; i++)
@@ -56,16 +126,228 @@ int read_disk_sector(int lba, int total, void* buf)
     return 0;
 }
 
+/**
+ * @brief Sleep until the disk has finished the command, it raises IRQ 14 then
+ * @return int: 0 if success, -EIO if the disk reports an error
+ */
+static int wait_disk_ready()
+{
+    unsigned char status = wait_disk_status(ATA_STATUS_BSY, 0);
+    return (status & ATA_STATUS_ERR) ? -EIO : 0;
+}
+
+/**
+ * Write sectors with PIO
+ * Reference: https://wiki.osdev.org/ATA_PIO_Mode
+ * @param lba: The first sector to write
+ * @param total: Number of sectors to write(1-256, 256 is sent as 0)
+ * @param buf: The data to write
+ */
+int write_disk_sector(int lba, int total, void* buf)
+{
+    outb(0x1F6, ((lba >> 24) & 0x0F) | 0xE0);
+    outb(0x1F2, (unsigned char)total); // 0 means 256 sectors
+    outb(0x1F3, (unsigned char)(lba & 0xff));
+    outb(0x1F4, (unsigned char)(lba >> 8));
+    outb(0x1F5, (unsigned char)(lba >> 16));
+
+    // 0x30: WRITE SECTOR(S) PIO
+    outb(0x1F7, 0x30);
+    unsigned short* ptr = (unsigned short*) buf;
+    for (int b = 0; b < total; b++)
+    {
+        // Wait for BSY to clear and DRQ to set, the drive interrupts after every sector but not before the first one
+        unsigned char status = b == 0 ? poll_disk_status(ATA_STATUS_BSY | ATA_STATUS_DRQ, ATA_STATUS_DRQ)
+                                      : wait_disk_status(ATA_STATUS_BSY | ATA_STATUS_DRQ, ATA_STATUS_DRQ);
+        if (status & ATA_STATUS_ERR)
+        {
+            return -EIO;
+        }
+
+        outsw(0x1F0, ptr, 256);
+        ptr += 256;
+    }
+
+    return wait_disk_ready();
+}
+
+/**
+ * @brief Ask the drive to commit its write cache to the media
+ * Writes are not flushed one by one, callers batch them and flush once
+ */
+int flush_disk_cache(struct disk* _disk)
+{
+    if (_disk->type != REAL_DISK_TYPE){
+        return -EIO;
+    }
+
+    mutex_lock(&ata_lock);
+    outb(0x1F6, 0xE0);
+    outb(0x1F7, 0xE7); // 0xE7: CACHE FLUSH
+    int res = wait_disk_ready();
+    mutex_unlock(&ata_lock);
+    return res;
+}
+
+static bool is_extended_partition(struct mbr_partition_entry* entry)
+{
+    return entry->type == 0x05 || entry->type == 0x0F || entry->type == 0x85;
+}
+
+static bool is_valid_partition(struct mbr_partition_entry* entry)
+{
+    // The status byte filters out boot code that happens to sit where the table would be
+    return (entry->status == 0x00 || entry->status == 0x80) && entry->type != MBR_TYPE_EMPTY
+        && entry->lba_first != 0 && entry->sectors != 0;
+}
+
+/**
+ * @brief Read a sector holding a partition table
+ * @return The 4 entries of the table, 0 if the sector has no boot signature
+ */
+static struct mbr_partition_entry* read_partition_sector(unsigned int lba, unsigned char* sector)
+{
+    if (read_disk_block(&disk, lba, 1, sector) != 0 || *(unsigned short*)(sector + MBR_SIGNATURE_OFFSET) != MBR_SIGNATURE)
+    {
+        return 0;
+    }
+
+    return (struct mbr_partition_entry*)(sector + MBR_PARTITION_TABLE_OFFSET);
+}
+
+static void add_partition(unsigned int lba, unsigned int sectors)
+{
+    if (total_partitions == MAX_PARTITIONS)
+    {
+        return;
+    }
+
+    struct disk* part = &partitions[total_partitions];
+    memset(part, 0, sizeof(struct disk));
+    part->type = REAL_DISK_TYPE;
+    part->sector_size = SECTOR_SIZE;
+    part->disk_id = PARTITION_DISK_ID_BASE + total_partitions;
+    part->lba_offset = lba;
+    part->total_sectors = sectors;
+    mutex_init(&part->fs_lock);
+    total_partitions ++;
+}
+
+/**
+ * @brief Follow the chain of extended boot records, each holds one logical partition and the link to the next record
+ * Logical partitions start relative to their record, the links relative to the extended partition
+ * @param extended_lba: The first sector of the extended partition
+ */
+static void read_extended_partitions(unsigned int extended_lba)
+{
+    unsigned char sector[SECTOR_SIZE];
+    unsigned int lba = extended_lba;
+    for (int i = 0; i < MAX_PARTITIONS; i++) // Bounded, so a chain that loops back ends
+    {
+        struct mbr_partition_entry* entries = read_partition_sector(lba, sector);
+        if (!entries)
+        {
+            return;
+        }
+
+        if (is_valid_partition(&entries[0]) && !is_extended_partition(&entries[0]))
+        {
+            add_partition(lba + entries[0].lba_first, entries[0].sectors);
+        }
+
+        if (!is_valid_partition(&entries[1]) || !is_extended_partition(&entries[1]))
+        {
+            return;
+        }
+        lba = extended_lba + entries[1].lba_first;
+    }
+}
+
+/**
+ * @brief Find the primary and logical partitions of the primary hard disk
+ * Reference: https://wiki.osdev.org/Partition_Table
+ */
+static void read_partition_table()
+{
+    unsigned char sector[SECTOR_SIZE];
+    struct mbr_partition_entry* entries = read_partition_sector(0, sector);
+    if (!entries)
+    {
+        return;
+    }
+
+    unsigned int extended_lba = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (!is_valid_partition(&entries[i]))
+        {
+            continue;
+        }
+
+        if (is_extended_partition(&entries[i]))
+        {
+            extended_lba = extended_lba ? extended_lba : entries[i].lba_first;
+            continue;
+        }
+        add_partition(entries[i].lba_first, entries[i].sectors);
+    }
+
+    if (extended_lba)
+    {
+        read_extended_partitions(extended_lba);
+    }
+}
+
 void search_and_init_disk()
 {
+    mutex_init(&ata_lock);
+    wait_queue_init(&ata_wait);
     memset(&disk, 0, sizeof(struct disk));
     disk.type = REAL_DISK_TYPE;
     disk.sector_size = SECTOR_SIZE;
     disk.disk_id = 0; // TODO: More disk support
-    disk.filesystem = resolve_fs(&disk);
+    mutex_init(&disk.fs_lock);
+
+    memset(&memory_disk, 0, sizeof(struct disk));
+    memory_disk.type = MEMORY_DISK_TYPE;
+    memory_disk.sector_size = SECTOR_SIZE;
+    memory_disk.disk_id = MEMORY_DISK_ID;
+    mutex_init(&memory_disk.fs_lock);
+
+    mount(memory_disk.disk_id, TMPFS_MOUNT_POINT);
+
+    // A volume at LBA 0(the BPB in boot/boot.S) covers the whole disk, otherwise mount its partitions
+    total_partitions = 0;
+    if (mount(disk.disk_id, "0:/") == 0)
+    {
+        return;
+    }
+
+    read_partition_table();
+    for (int i = 0; i < total_partitions; i++)
+    {
+        char target[] = "0:/";
+        if (partitions[i].disk_id >= MAX_DRIVES)
+        {
+            break;
+        }
+
+        target[0] = '0' + partitions[i].disk_id;
+        mount(partitions[i].disk_id, target);
+    }
 }
 
-// Only get the disk 0
+/**
+ * @brief Let the drive wake its waiters with IRQ 14, call after idt_init()
+ * Until the scheduler runs the waits just poll the status
+ */
+void init_disk_irq()
+{
+    interrupt_register(IRQ_BASE_VECTOR + ATA_PRIMARY_IRQ, ata_interrupt_handler);
+    outb(0x3F6, 0x00); // Device control: nIEN clear, the drive asserts INTRQ
+}
+
+// Get the disk 0, the memory disk or a partition of disk 0 by disk id
 struct disk* get_disk(int index)
 {
     if(index == 0)
@@ -73,21 +355,113 @@ struct disk* get_disk(int index)
         return &disk;
     }
 
+    if(index == MEMORY_DISK_ID)
+    {
+        return &memory_disk;
+    }
+
+    if(index >= PARTITION_DISK_ID_BASE && index < PARTITION_DISK_ID_BASE + total_partitions)
+    {
+        return &partitions[index - PARTITION_DISK_ID_BASE];
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Check that a request stays on the disk and move it to the sectors of the device
+ * @return int: 0 if success, -EIO if the disk has no device or the request runs past its end
+ */
+static int map_disk_request(struct disk* _disk, unsigned int* lba, int total)
+{
+    if (_disk->type != REAL_DISK_TYPE || total < 0){
+        return -EIO;
+    }
+
+    if (_disk->total_sectors && (*lba >= _disk->total_sectors || (unsigned int)total > _disk->total_sectors - *lba)){
+        return -EIO;
+    }
+
+    // A sector past the 28-bit LBA would wrap around to the start of the device
+    if (_disk->lba_offset > DISK_MAX_LBA || *lba > DISK_MAX_LBA - _disk->lba_offset
+        || (unsigned int)total > DISK_MAX_LBA - _disk->lba_offset - *lba){
+        return -EIO;
+    }
+
+    *lba += _disk->lba_offset;
     return 0;
 }
 
 int read_disk_block(struct disk* _disk, unsigned int lba, int total, void* buf)
 {
-    if (_disk != &disk){
+    if (map_disk_request(_disk, &lba, total) != 0){
         return -EIO;
     }
 
-    return read_disk_sector(lba, total, buf);
+    int res = 0;
+    mutex_lock(&ata_lock);
+
+    // One ATA command transfers at most DISK_MAX_SECTORS_PER_REQUEST sectors
+    while (total > DISK_MAX_SECTORS_PER_REQUEST)
+    {
+        res = read_disk_sector(lba, DISK_MAX_SECTORS_PER_REQUEST, buf);
+        if (res < 0)
+        {
+            goto out;
+        }
+
+        _disk->stats.read_requests ++;
+        _disk->stats.read_sectors += DISK_MAX_SECTORS_PER_REQUEST;
+        lba += DISK_MAX_SECTORS_PER_REQUEST;
+        total -= DISK_MAX_SECTORS_PER_REQUEST;
+        buf += DISK_MAX_SECTORS_PER_REQUEST * SECTOR_SIZE;
+    }
+
+    _disk->stats.read_requests ++;
+    _disk->stats.read_sectors += total;
+    res = read_disk_sector(lba, total, buf);
+
+out:
+    mutex_unlock(&ata_lock);
+    return res;
+}
+
+int write_disk_block(struct disk* _disk, unsigned int lba, int total, void* buf)
+{
+    if (map_disk_request(_disk, &lba, total) != 0){
+        return -EIO;
+    }
+
+    int res = 0;
+    mutex_lock(&ata_lock);
+
+    while (total > DISK_MAX_SECTORS_PER_REQUEST)
+    {
+        res = write_disk_sector(lba, DISK_MAX_SECTORS_PER_REQUEST, buf);
+        if (res < 0)
+        {
+            goto out;
+        }
+
+        _disk->stats.write_requests ++;
+        _disk->stats.write_sectors += DISK_MAX_SECTORS_PER_REQUEST;
+        lba += DISK_MAX_SECTORS_PER_REQUEST;
+        total -= DISK_MAX_SECTORS_PER_REQUEST;
+        buf += DISK_MAX_SECTORS_PER_REQUEST * SECTOR_SIZE;
+    }
+
+    _disk->stats.write_requests ++;
+    _disk->stats.write_sectors += total;
+    res = write_disk_sector(lba, total, buf);
+
+out:
+    mutex_unlock(&ata_lock);
+    return res;
 }
 
 /**
  * @brief Create a disk stream
- * @param disk_id: The disk id(Only support 0)
+ * @param disk_id: The disk id, see get_disk()
  * @return struct disk_stream*: The disk stream
  */
 struct disk_stream* create_disk_stream(int disk_id)
@@ -112,7 +486,7 @@ void destroy_disk_stream(struct disk_stream* stream)
  * @param stream: The disk stream
  * @param pos: The position to seek
  */
-int seek_disk_stream(struct disk_stream* stream, int pos)
+int seek_disk_stream(struct disk_stream* stream, unsigned long long pos)
 {
     stream->pos = pos;
     return 0;
@@ -120,6 +494,8 @@ int seek_disk_stream(struct disk_stream* stream, int pos)
 
 /**
  * @brief Read from the disk stream
+ * Partial sectors at both ends go through a sector buffer,
+ * the whole sectors in between are read straight into out with one block request
  * @param stream: The disk stream
  * @param total: The total bytes to read
  * @param out: The output buffer
@@ -127,28 +503,119 @@ int seek_disk_stream(struct disk_stream* stream, int pos)
  */
 int read_disk_stream(struct disk_stream* stream, int total, void* out)
 {
-    int sector = stream->pos / SECTOR_SIZE;
-    int offset = stream->pos % SECTOR_SIZE;
-
     char buf[SECTOR_SIZE];
-    int res = read_disk_block(stream->disk, sector, 1, buf);
-    if(res < 0)
+    char* dest = (char*)out;
+    while(total > 0)
     {
-        return res;
-    }
+        unsigned int sector = stream->pos / SECTOR_SIZE;
+        int offset = stream->pos % SECTOR_SIZE;
+        int res = 0;
+        int total_to_read = 0;
 
-    int total_to_read = total > SECTOR_SIZE? SECTOR_SIZE: total;
-    for(int i = 0; i < total_to_read; i++)
-    {
-        *(char*)out++ = buf[offset + i]; // MOD 06-21: out指针也要跟着走
+        if(offset == 0 && total >= SECTOR_SIZE)
+        {
+            int sectors = total / SECTOR_SIZE;
+            total_to_read = sectors * SECTOR_SIZE;
+            res = read_disk_block(stream->disk, sector, sectors, dest);
+        }
+        else
+        {
+            total_to_read = SECTOR_SIZE - offset;
+            if(total_to_read > total)
+            {
+                total_to_read = total;
+            }
+
+            res = read_disk_block(stream->disk, sector, 1, buf);
+            memcpy(dest, buf + offset, total_to_read);
+        }
+
+        if(res < 0)
+        {
+            return res;
+        }
+
+        dest += total_to_read;
+        total -= total_to_read;
+        stream->pos += total_to_read;
     }
 
-    stream->pos += total_to_read;
-    if(total > SECTOR_SIZE)
+    return 0;
+}
+
+/**
+ * @brief Print the request statistics of a disk
+ * The average request size shows how well reads and writes are coalesced
+ * @param _disk: The disk
+ */
+void print_disk_stats(struct disk* _disk)
+{
+    struct disk_stats* stats = &_disk->stats;
+    print("Disk ");
+    put_int(_disk->disk_id);
+    print(" reads: ");
+    put_uint(stats->read_requests);
+    print(" requests, avg ");
+    put_uint(stats->read_requests ? stats->read_sectors * _disk->sector_size / stats->read_requests : 0);
+    print(" bytes; writes: ");
+    put_uint(stats->write_requests);
+    print(" requests, avg ");
+    put_uint(stats->write_requests ? stats->write_sectors * _disk->sector_size / stats->write_requests : 0);
+    print(" bytes\n");
+}
+
+/**
+ * @brief Write to the disk stream
+ * Partial sectors at both ends are read, patched and written back,
+ * the whole sectors in between are written with one block request
+ * @param stream: The disk stream
+ * @param total: The total bytes to write
+ * @param in: The data to write
+ * @return int: 0 if success, otherwise error code
+ */
+int write_disk_stream(struct disk_stream* stream, int total, const void* in)
+{
+    char buf[SECTOR_SIZE];
+    const char* src = (const char*)in;
+    while(total > 0)
     {
-        // Iterate to read the next sector
-        return read_disk_stream(stream, total - total_to_read, (char*)out);
+        unsigned int sector = stream->pos / SECTOR_SIZE;
+        int offset = stream->pos % SECTOR_SIZE;
+        int res = 0;
+        int total_to_write = 0;
+
+        if(offset == 0 && total >= SECTOR_SIZE)
+        {
+            int sectors = total / SECTOR_SIZE;
+            total_to_write = sectors * SECTOR_SIZE;
+            res = write_disk_block(stream->disk, sector, sectors, (void*)src);
+        }
+        else
+        {
+            total_to_write = SECTOR_SIZE - offset;
+            if(total_to_write > total)
+            {
+                total_to_write = total;
+            }
+
+            res = read_disk_block(stream->disk, sector, 1, buf);
+            if(res < 0)
+            {
+                return res;
+            }
+            memcpy(buf + offset, src, total_to_write);
+            res = write_disk_block(stream->disk, sector, 1, buf);
+        }
+
+        if(res < 0)
+        {
+            return res;
+        }
+
+        src += total_to_write;
+        total -= total_to_write;
+        stream->pos += total_to_write;
     }
 
-    return res;
+    return 0;
 }
\ No newline at end of file
@@ -4,13 +4,38 @@
 #include "types.h"
 #include "disk.h"
 #include "mm.h"
+#include "config.h"
+#include "page.h"
+#include "page_cache.h"
+#include "vnode.h"
 
 #define FAT16_SIGNATURE 0x29
 #define FAT16_ENRTY_SIZE 0x02
+#define FAT32_ENRTY_SIZE 0x04
+
+// Cluster values as returned by get_entry(), FAT16 values are widened to the 28 bits of FAT32
+#define FAT_FREE_CLUSTER 0x0000
+#define FAT_BAD_CLUSTER 0x0FFFFFF7
+#define FAT_END_OF_CHAIN 0x0FFFFFF8 // Values >= 0x0FFFFFF8 mark the last cluster of a chain
+#define FAT_END_OF_CHAIN_MARK 0x0FFFFFFF // Value written to terminate a chain
+#define FAT16_RESERVED_CLUSTER 0xFFF7 // FAT16 values from 0xFFF7 up are bad or end of chain
+#define FAT32_CLUSTER_MASK 0x0FFFFFFF // The top 4 bits of a FAT32 entry are reserved
+
+// Number of FAT sectors kept in memory by the FAT cache(8 * 512B = one heap block)
+#define FAT16_FAT_CACHE_SECTORS 8
+
+// Most file pages read into the page cache with one pass over the cluster chain
+#define FAT16_PAGE_FILL_BATCH 32
+
+// Directory entry name[0] markers
+#define FAT16_ENTRY_END 0x00
+#define FAT16_ENTRY_DELETED 0xE5
+#define FAT16_ATTR_LONG_NAME 0x0F
 
 #define u8 uint8_t
 #define u16 uint16_t
 #define u32 uint32_t
+#define u64 uint64_t
 
 typedef char FAT16_ITEM_TYPE;
 #define FAT16_ITEM_TYPE_FILE 1
@@ -28,28 +53,6 @@ typedef char FAT16_ITEM_TYPE;
 
 
 
-void* fat16_open_file(struct disk* disk, struct path_part* path, FILE_OPEN_MODE mode);
-int resolve_fat16(struct disk* disk);
-int fat16_read_file(struct disk* disk, void* fd, u32 size, u32 nb, char* out);
-int fat16_close(void* private);
-
-struct fat_header{
-    u8 jump[3];
-    u8 oem[8];
-    u16 bytes_per_sector;
-    u8 sectors_per_cluster;
-    u16 reserved_sectors;
-    u8 fat_count;
-    u16 root_entry_count;
-    u16 total_sectors;
-    u8 media_type;
-    u16 sectors_per_fat;
-    u16 sectors_per_track;
-    u16 head_count;
-    u32 hidden_sectors;
-    u32 total_sectors_large;
-} __attribute__((packed));
-
 struct extended_bios_parameter_block{
     u8 drive_number;
     u8 reserved;
@@ -87,7 +90,9 @@ struct fat16_fs_info{
 // fat16_directory represents a directory
 struct fat16_directory{
     struct fat16_entry* entries; // Point to the first entry in this directory
-    int totel_entries; // Total entries in this directory
+    int totel_entries; // Total entry slots(including deleted ones) before the end marker
+    int max_entries; // Total entry slots held in entries
+    int first_cluster; // The first cluster of this directory, 0 for the root directory
     int sector_begin; // The first sector of this directory
     int sector_end; // The last sector of this directory
 };
@@ -98,6 +103,7 @@ struct fat16_directory{
  * @param directory struct fat16_directory* - The directory that the item is pointing to(union shared with entry)
  * @param entry struct fat16_entry* - The entry that the item is pointing to(union shared with directory)
  * @param type FAT16_ITEM_TYPE - The type of the item
+ * @param entry_position u64 - The byte address of the item's directory entry on the disk
  * 
  */
 struct fat16_item{
@@ -107,38 +113,139 @@ struct fat16_item{
     };
 
     FAT16_ITEM_TYPE type;
+    u64 entry_position;
+};
+
+/**
+ * fat16_file is the state of an open file shared by all its descriptors, the data of its vnode
+ * @param item struct fat16_item* - The item of the file, its directory entry and where the entry is on the disk
+ * @param dirty bool - The directory entry was changed and has to be written back
+ * @param unlinked bool - The directory entry was deleted while the file was open, its clusters are freed on the last close
+ * @param reserved bool - Clusters were added to the chain, the ones past the end of the file are freed on the last close
+ */
+struct fat16_file{
+    struct fat16_item* item;
+    bool dirty;
+    bool unlinked;
+    bool reserved;
 };
 
 /** 
  * fat16_file_descriptor represents a file descriptor
- * @param item struct fat16_item* - The item that the file descriptor is pointing to
+ * @param vnode struct vnode* - The vnode of the file, keyed by the position of its directory entry
+ * @param file struct fat16_file* - The shared state of the file, vnode->data
  * @param offset uint32_t - The current offset(for seeking) of the file 
+ * @param mode FILE_OPEN_MODE - The mode the file was opened in
+ * @param disk struct disk* - The disk that the file is on
  * 
  */
 struct fat16_file_descriptor{
-    struct fat16_item* item;
+    struct vnode* vnode;
+    struct fat16_file* file;
     u32 offset;
+    FILE_OPEN_MODE mode;
+    struct disk* disk;
+};
+
+/**
+ * fat16_dir_stream iterates over a directory with constant memory
+ * @param disk struct disk* - The disk that the directory is on
+ * @param cluster int - The cluster held in buffer, 0 for the root directory(or once the end is reached)
+ * @param entries struct fat16_entry* - The entries being iterated, the root copy or buffer
+ * @param total int - The number of entries in entries
+ * @param index int - The index of the next entry to look at
+ * @param buffer struct fat16_entry* - One cluster of a subdirectory, 0 for the root directory
+ */
+struct fat16_dir_stream{
+    struct disk* disk;
+    int cluster;
+    struct fat16_entry* entries;
+    int total;
+    int index;
+    struct fat16_entry* buffer;
 };
 
+/**
+ * A window of consecutive FAT sectors kept in memory,
+ * so walking a cluster chain does not issue one disk read per FAT entry
+ * FAT updates stay in the window until it is replaced or flushed, then go to every FAT copy at once
+ * @param first_sector int - The first sector held in buffer, -1 if the cache is empty
+ * @param dirty bool - The window has been modified since it was read
+ * @param buffer u8* - FAT16_FAT_CACHE_SECTORS sectors of FAT data
+ */
+struct fat16_fat_cache{
+    int first_sector;
+    bool dirty;
+    u8* buffer;
+};
+
+/**
+ * Free cluster bitmap, built from the FAT when the filesystem is resolved
+ * @param map u32* - One bit per cluster, set if the cluster is in use
+ * @param total_clusters u32 - Number of cluster numbers(including the reserved 0 and 1)
+ * @param free_clusters u32 - Number of free clusters left
+ * @param next_free u32 - Where the allocator starts looking when a new chain has no goal
+ */
+struct fat16_free_map{
+    u32* map;
+    u32 total_clusters;
+    u32 free_clusters;
+    u32 next_free;
+};
+
+/**
+ * Per volume state, shared by FAT16 and FAT32
+ * @param type int - FAT_TYPE_16 or FAT_TYPE_32
+ * @param fat_sectors u32 - Sectors per FAT(the 16 bit header field is 0 on FAT32)
+ * @param data_sector u32 - The first sector of cluster 2
+ * @param root_cluster u32 - The first cluster of a FAT32 root directory, 0 for the fixed FAT16 root directory
+ * @param info_sector u32 - The sector given to sync_info
+ * @param synced_free_clusters u32 - The free cluster count last recorded on the volume
+ * @param sync_info FAT_SYNC_INFO - Records the free cluster count on flush, 0 if the volume has no such record
+ */
 struct fat16_data{
     struct fat16_fs_info header;
-    struct fat16_directory root;
+    struct fat16_directory root; // Only loaded for the fixed FAT16 root directory
+
+    int type;
+    u32 fat_sectors;
+    u32 data_sector;
+    u32 root_cluster;
+    u32 info_sector;
+    u32 synced_free_clusters;
+    FAT_SYNC_INFO sync_info;
 
     // Stream for reading cluster data
     struct disk_stream* read_cluster_streamer;
 
-    // Stream the file allocation table
-    struct disk_stream* read_fat_streamer;
+    // Stream for writing cluster and directory data
+    struct disk_stream* write_streamer;
+
+    // Cached window of the file allocation table
+    struct fat16_fat_cache fat_cache;
 
-    // Stream for reading directory data
-    struct disk_stream* directory_streamer;
+    struct fat16_free_map free_map;
 };
 
 struct filesystem fat16_fs = {
     .open_file = fat16_open_file,
     .read_file = fat16_read_file,
     .close = fat16_close,
-    .resolve = resolve_fat16
+    .resolve = resolve_fat16,
+    .stat = fat16_stat,
+    .write_file = fat16_write_file,
+    .truncate = fat16_truncate,
+    .allocate = fat16_allocate,
+    .flush = fat16_flush,
+    .unlink = fat16_unlink,
+    .open_dir = fat16_open_dir,
+    .read_dir = fat16_read_dir,
+    .close_dir = fat16_close_dir,
+    .readv = fat16_readv,
+    .writev = fat16_writev,
+    .map_page = fat16_map_page,
+    .unmount = fat16_unmount,
+    .copy_range = fat16_copy_range
 };
 
 
@@ -159,57 +266,33 @@ void init_fat16_data(struct disk* disk, struct fat16_data* data)
     memset(data, 0, sizeof(struct fat16_data));
 
     data->read_cluster_streamer = create_disk_stream(disk->disk_id);
-    data->read_fat_streamer = create_disk_stream(disk->disk_id);
-    data->directory_streamer = create_disk_stream(disk->disk_id);
+    data->write_streamer = create_disk_stream(disk->disk_id);
+    data->fat_cache.first_sector = -1;
+    data->fat_cache.buffer = (u8*)kmalloc(FAT16_FAT_CACHE_SECTORS * disk->sector_size);
 }
 
 /**
  * Convert a sector to an address
  * @param[in] disk struct disk* - The disk that the filesystem is on
- * @param[in] sector int - The sector to convert
+ * @param[in] sector u32 - The sector to convert
+ * @return u64 - The byte address, past 4 GiB on a large FAT32 volume
  */
-int sector_to_address(struct disk* disk, int sector)
+u64 sector_to_address(struct disk* disk, u32 sector)
 {
-    return sector * disk->sector_size;
+    return (u64)sector * disk->sector_size;
 }
 
 /**
- * Get total entries in a directory
- * @param[in] disk struct disk* - The disk that the filesystem is on
- * @param[in] start_sector u32 - The sector to start reading the directory from
+ * Count the entry slots of a directory that is already in memory
+ * @param[in] entries struct fat16_entry* - The directory entries
+ * @param[in] max_entries int - The number of entries in the buffer
+ * @return int - The number of slots(including deleted ones) before the end marker
  */
-int get_total_entries(struct disk* disk, u32 start_sector)
+static int count_directory_entries(struct fat16_entry* entries, int max_entries)
 {
-    struct fat16_entry dir;
-    struct fat16_entry empty_dir;
-
-    memset(&empty_dir, 0, sizeof(struct fat16_entry));
-
-    struct fat16_data* data = (struct fat16_data*)disk->data;
-
-    int start_pos = sector_to_address(disk, start_sector);
-
-    struct disk_stream* stream = data->directory_streamer;
-    if(seek_disk_stream(stream, start_pos) != 0)
-    {
-        return -EIO;
-    }
-
     int cnt = 0;
-    while(1)
+    while(cnt < max_entries && entries[cnt].name[0] != FAT16_ENTRY_END)
     {
-        if(read_disk_stream(stream, sizeof(dir), &dir) != 0)
-        {
-            return -EIO;
-        }
-
-        if(dir.name[0] == 0x00) // Empty
-        {
-            break;
-        } else if(dir.name[0] == 0xE5) // Deleted
-        {
-            continue;
-        }
         cnt ++;
     }
     return cnt;
@@ -217,11 +300,12 @@ int get_total_entries(struct disk* disk, u32 start_sector)
 
 /**
  * @brief Get the root directory into memory
+ * The root directory of FAT16 is a fixed area, read it with one disk request
  */
 int get_root_dir(struct disk* disk, struct fat16_data* data, struct fat16_directory* directory)
 {
     struct fat16_fs_info* header = &data->header;
-    int root_dir_sector_pos = (header->header.fat_count * header->header.sectors_per_fat) + header->header.reserved_sectors; 
+    int root_dir_sector_pos = (header->header.fat_count * data->fat_sectors) + header->header.reserved_sectors; 
     int root_dir_entries = header->header.root_entry_count;
     int root_dir_size = root_dir_entries * sizeof(struct fat16_entry);
     int total_sectors = root_dir_size / disk->sector_size;
@@ -230,76 +314,154 @@ int get_root_dir(struct disk* disk, struct fat16_data* data, struct fat16_direct
         total_sectors ++;
     }
 
-    int total_entries = get_total_entries(disk, root_dir_sector_pos);
-
-    struct fat16_entry* dir = (struct fat16_entry*) kmalloc(root_dir_size);
+    struct fat16_entry* dir = (struct fat16_entry*) kmalloc(total_sectors * disk->sector_size);
     if(!dir){
         return -ENOMEM;
     }
 
-    struct disk_stream* stream = data->directory_streamer;
-    if(seek_disk_stream(stream, sector_to_address(disk, root_dir_sector_pos)) != 0)
-    {
-        return -EIO;
-    }
-
-    if(read_disk_stream(stream, root_dir_size, dir) != 0)
+    if(read_disk_block(disk, root_dir_sector_pos, total_sectors, dir) != 0)
     {
+        kfree(dir);
         return -EIO;
     }
 
     directory->entries = dir;
-    directory->totel_entries = total_entries;
+    directory->totel_entries = count_directory_entries(dir, root_dir_entries);
+    directory->max_entries = root_dir_entries;
+    directory->first_cluster = 0;
     directory->sector_begin = root_dir_sector_pos;
     directory->sector_end = root_dir_sector_pos + (root_dir_size / disk->sector_size); // Point to the last sector
 
     return 0;
 }
 
+static int init_free_map(struct disk* disk, struct fat16_data* data);
+
 /**
- * Resolve the fat16 filesystem
+ * @brief Free the state of a volume that failed to mount
+ */
+static void free_fat16_data(struct fat16_data* data)
+{
+    if(data->root.entries) kfree(data->root.entries);
+    if(data->free_map.map) kfree(data->free_map.map);
+    if(data->fat_cache.buffer) kfree(data->fat_cache.buffer);
+    if(data->read_cluster_streamer) destroy_disk_stream(data->read_cluster_streamer);
+    if(data->write_streamer) destroy_disk_stream(data->write_streamer);
+    kfree(data);
+}
+
+/**
+ * Mount a FAT volume once its driver has parsed the boot sector
+ * Loads the fixed root directory(FAT16) and builds the free cluster bitmap
  * @param[in] disk struct disk* - The disk that the filesystem is on
- * @return int - 0 if the filesystem is resolved successfully, otherwise return an error code
- 
+ * @param[in] fs struct filesystem* - The driver mounting the volume
+ * @param[in] volume struct fat_volume* - The layout of the volume
+ * @return int - 0 if the volume is mounted, otherwise return an error code
  */
-int resolve_fat16(struct disk* disk)
+int fat_mount(struct disk* disk, struct filesystem* fs, struct fat_volume* volume)
 {
+    // Sectors past DISK_MAX_LBA can not be reached, a volume reaching them is not mounted
+    u32 total_sectors = volume->header.total_sectors ? volume->header.total_sectors : volume->header.total_sectors_large;
+    if(disk->lba_offset > DISK_MAX_LBA || total_sectors > DISK_MAX_LBA - disk->lba_offset)
+    {
+        return -EIO;
+    }
+
+    int res = 0;
     struct fat16_data* data = (struct fat16_data*) kmalloc(sizeof(struct fat16_data));
+    if(!data)
+    {
+        return -ENOMEM;
+    }
+
     init_fat16_data(disk, data);
+    if(!data->read_cluster_streamer || !data->write_streamer || !data->fat_cache.buffer)
+    {
+        res = -ENOMEM;
+        goto error;
+    }
+
+    struct fat_header* header = &data->header.header;
+    *header = volume->header;
+    data->type = volume->type;
+    data->fat_sectors = volume->fat_sectors;
+    data->root_cluster = volume->root_cluster;
+    data->info_sector = volume->info_sector;
+    data->synced_free_clusters = volume->free_clusters;
+    data->sync_info = volume->sync_info;
+
+    u32 root_size = header->root_entry_count * sizeof(struct fat16_entry);
+    data->data_sector = header->reserved_sectors + header->fat_count * data->fat_sectors + (root_size + disk->sector_size - 1) / disk->sector_size;
 
     disk->data = data;
-    disk->filesystem = &fat16_fs;
+    disk->filesystem = fs;
+
+    if(!data->root_cluster && get_root_dir(disk, data, &data->root) != 0)
+    {
+        res = -EIO;
+        goto error;
+    }
+
+    if(init_free_map(disk, data) != 0)
+    {
+        res = -EIO;
+        goto error;
+    }
+
+    if(volume->next_free >= 2 && volume->next_free < data->free_map.total_clusters)
+    {
+        data->free_map.next_free = volume->next_free;
+    }
+
+    return 0;
+
+error:
+    disk->data = 0;
+    disk->filesystem = 0;
+    free_fat16_data(data);
+    return res;
+}
 
+/**
+ * Resolve the fat16 filesystem
+ * @param[in] disk struct disk* - The disk that the filesystem is on
+ * @return int - 0 if the filesystem is resolved successfully, otherwise return an error code
+ 
+ */
+int resolve_fat16(struct disk* disk)
+{
     struct disk_stream* stream = create_disk_stream(disk->disk_id);
     if(!stream)
     {
-        kfree(data);
         return -ENOMEM;
     }
 
-    char buf[512];
-    if(read_disk_stream(stream, sizeof(struct fat16_fs_info), &data->header) != 0)
+    struct fat16_fs_info info;
+    int res = read_disk_stream(stream, sizeof(struct fat16_fs_info), &info);
+    destroy_disk_stream(stream);
+    if(res != 0)
     {
-        kfree(data);
         return -EIO;
     }
 
-    u8 signature = data->header.shared.ebpb.boot_signature;
+    u8 signature = info.shared.ebpb.boot_signature;
     if(signature != 0x28 && signature != 0x29)
     {
-        kfree(data);
         return -EINVARG;
     }
-    
-    if(get_root_dir(disk, data, &data->root) != 0)
+
+    // FAT32 leaves the 16 bit FAT size empty, it is mounted by the FAT32 driver
+    if(info.header.sectors_per_fat == 0 || info.header.root_entry_count == 0)
     {
-        kfree(data);
-        return -EIO;
+        return -EINVARG;
     }
 
-    if(stream) destroy_disk_stream(stream);
-
-    return 0;
+    struct fat_volume volume;
+    memset(&volume, 0x00, sizeof(volume));
+    volume.type = FAT_TYPE_16;
+    volume.header = info.header;
+    volume.fat_sectors = info.header.sectors_per_fat;
+    return fat_mount(disk, &fat16_fs, &volume);
 }
 
 /**
@@ -372,7 +534,7 @@ struct fat16_entry* clone_fat16_entry(struct fat16_entry* entry, int size)
  */
 static u32 get_first_cluster(struct fat16_entry* entry)
 {
-    return (entry->first_cluster_high) | entry->first_cluster_low;
+    return ((u32)entry->first_cluster_high << 16) | entry->first_cluster_low;
 }
 
 /**
@@ -380,12 +542,12 @@ static u32 get_first_cluster(struct fat16_entry* entry)
  * @warning The cluster must start from 2
  * @param data struct fat16_data* - The fat16 data structure
  * @param cluster int - The cluster to get the sector from
- * @return int - The sector of the cluster
+ * @return u32 - The sector of the cluster
 
  */
-static int cluster_to_sector(struct fat16_data* data, int cluster)
+static u32 cluster_to_sector(struct fat16_data* data, int cluster)
 {
-    return data->root.sector_end + ((cluster - 2) * data->header.header.sectors_per_cluster);
+    return data->data_sector + ((u32)(cluster - 2) * data->header.header.sectors_per_cluster);
 }
 
 /**
@@ -400,256 +562,242 @@ static u32 get_first_sector(struct fat16_data* data)
 }
 
 /**
- * @brief get the FAT entry for the specified cluster number
+ * @brief Write the FAT cache window back to every copy of the FAT if it was modified
  * @param disk struct disk* - The disk that the filesystem is on
- * @param cluster int - The cluster to get the entry from
- * @return u16 - The FAT entry at the specified cluster
+ * @return int - 0 if success, otherwise return an error code
  */
-static u16 get_entry(struct disk* disk, int cluster)
+static int flush_fat_cache(struct disk* disk)
 {
     struct fat16_data* data = (struct fat16_data*)disk->data;
-    struct disk_stream* stream = data->read_fat_streamer;
-    if(!stream)
+    struct fat16_fat_cache* cache = &data->fat_cache;
+    if(!cache->dirty)
     {
-        return -EIO;
+        return 0;
     }
 
-    u32 fat_position = data->header.header.reserved_sectors * disk->sector_size; // Get the position of FAT area
-
-    // Position the FAT entry for the specified cluster
-    if(seek_disk_stream(stream, fat_position + (cluster * FAT16_ENRTY_SIZE)) != 0) // MOD: fat_pos + (xxx)
+    // The last window may reach past the end of the first FAT, never write beyond it
+    int fat_end = get_first_sector(data) + data->fat_sectors;
+    int total = fat_end - cache->first_sector;
+    if(total > FAT16_FAT_CACHE_SECTORS)
     {
-        return -EIO;
+        total = FAT16_FAT_CACHE_SECTORS;
     }
 
-    u16 result = 0;
-
-    // Get the FAT entry
-    if(read_disk_stream(stream, sizeof(u16), &result) !=0){
-        return -EIO;
+    for(int i = 0; i < data->header.header.fat_count; i++)
+    {
+        int sector = cache->first_sector + i * data->fat_sectors;
+        if(write_disk_block(disk, sector, total, cache->buffer) != 0)
+        {
+            return -EIO;
+        }
     }
 
-    return result;
+    cache->dirty = false;
+    return 0;
 }
 
 /**
- * @brief Get the cluster to use based on the cluster and offset
+ * @brief Get the address of a FAT entry in the FAT cache, loading its window if needed
  * @param disk struct disk* - The disk that the filesystem is on
- * @param cluster int - The current cluster
- * @return int - The next cluster in the chain
- 
+ * @param cluster int - The cluster of the entry
+ * @return u8* - The entry inside the cache buffer(2 or 4 bytes wide), 0 if the window can not be loaded
  */
-static int get_cluster_for_offset(struct disk* disk, int starting_cluster, int offset)
-{ 
-    struct fat16_data* data = disk->data;
-    int cluster_size = data->header.header.sectors_per_cluster * disk->sector_size;
-    int cluster_to_use = starting_cluster;
-    int clusters_ahead = offset / cluster_size; // Get the number of clusters ahead to read
-    for (int i = 0; i < clusters_ahead; i++)
+static u8* get_cached_entry(struct disk* disk, int cluster)
+{
+    struct fat16_data* data = (struct fat16_data*)disk->data;
+    struct fat16_fat_cache* cache = &data->fat_cache;
+    if(!cache->buffer)
     {
-        u16 entry = get_entry(disk, cluster_to_use);
-        if (entry == 0xFF8 || entry == 0xFFF) // Last entry in the file
-        {
-            return -EIO;
-        }
+        return 0;
+    }
+
+    u32 fat_offset = cluster * (data->type == FAT_TYPE_32 ? FAT32_ENRTY_SIZE : FAT16_ENRTY_SIZE);
+    int sector = get_first_sector(data) + fat_offset / disk->sector_size; // The FAT sector holding the entry
 
-        // Check for reserved sectors
-        if (entry == 0xFF0 || entry == 0xFF6)
+    if(cache->first_sector < 0 || sector < cache->first_sector || sector >= cache->first_sector + FAT16_FAT_CACHE_SECTORS)
+    {
+        if(flush_fat_cache(disk) != 0)
         {
-            return -EIO;
+            return 0;
         }
 
-        // If the entry is 0x00, the cluster is empty
-        if (entry == 0x00)
+        int first_sector = sector - ((sector - get_first_sector(data)) % FAT16_FAT_CACHE_SECTORS);
+        if(read_disk_block(disk, first_sector, FAT16_FAT_CACHE_SECTORS, cache->buffer) != 0)
         {
-            return -EIO;
+            cache->first_sector = -1;
+            return 0;
         }
-
-        cluster_to_use = entry;
+        cache->first_sector = first_sector;
     }
 
-    return cluster_to_use;
+    u32 cache_offset = (sector - cache->first_sector) * disk->sector_size + fat_offset % disk->sector_size;
+    return cache->buffer + cache_offset;
 }
 
 /**
- * @brief Read data from a cluster stream, the lower implementation of read_internal_data
+ * @brief get the FAT entry for the specified cluster number
+ * The FAT is read through fat_cache, a window of FAT16_FAT_CACHE_SECTORS sectors
  * @param disk struct disk* - The disk that the filesystem is on
- * @param stream struct disk_stream* - The stream to read from
- * @param cluster int - The cluster to read from
- * @param offset int - The offset within the cluster to read from
- * @param total int - The total bytes to read
- * @param out void* - The output buffer to store the read data
- * @return int - 0 if the data is read successfully, otherwise return an error code
- * @attention If the total bytes to read is greater than the cluster size, the function will find the next cluster in the FAT to read.
- 
+ * @param cluster int - The cluster to get the entry from
+ * @return int - The FAT entry at the specified cluster, otherwise return an error code
  */
-static int read_data_from_stream(struct disk* disk, struct disk_stream* stream, int cluster, int offset, int total, void* out)
+static int get_entry(struct disk* disk, int cluster)
 {
-    struct fat16_data* data = disk->data;
-    int cluster_size = data->header.header.sectors_per_cluster * disk->sector_size;
-    int cluster_to_use = get_cluster_for_offset(disk, cluster, offset);
-    if (cluster_to_use < 0)
-    {
-        return cluster_to_use;
-    }
-
-    int cluster_offset = offset % cluster_size;
-
-    int start_sector = cluster_to_sector(data, cluster_to_use);
-    int start_pos = (start_sector * disk->sector_size) + cluster_offset;
-    int total_to_read = total > cluster_size ? cluster_size : total;
-
-    if (seek_disk_stream(stream, start_pos) != 0)
-    {
-        return -EIO;
-    }
-
-    if(read_disk_stream(stream, total_to_read, out) != 0)
+    u8* entry = get_cached_entry(disk, cluster);
+    if(!entry)
     {
         return -EIO;
     }
 
-    total -= total_to_read;
-    if (total > 0)
+    if(((struct fat16_data*)disk->data)->type == FAT_TYPE_32)
     {
-        // Read the next cluster
-        return read_data_from_stream(disk, stream, cluster, offset + total_to_read, total, out + total_to_read);
+        return *(u32*)entry & FAT32_CLUSTER_MASK;
     }
 
-    return 0;
+    u16 value = *(u16*)entry;
+    return value >= FAT16_RESERVED_CLUSTER ? value | 0x0FFF0000 : value;
 }
 
 /**
- * @brief Read internal data from a cluster
+ * @brief Set the FAT entry for the specified cluster number
+ * The change stays in the FAT cache until flush_fat_cache()
  * @param disk struct disk* - The disk that the filesystem is on
- * @param cluster int - The cluster to read from
- * @param offset int - The offset within the cluster to read from
- * @param total int - The total bytes to read
- * @param out void* - The output buffer to store the read data
- * @return int - 0 if the data is read successfully, otherwise return an error code
-
+ * @param cluster int - The cluster to set the entry of
+ * @param value u32 - The new value of the entry, FAT16 keeps the low 16 bits
+ * @return int - 0 if success, otherwise return an error code
  */
-static int read_internal_data(struct disk* disk, int cluster, int offset, int total, void* out)
+static int set_entry(struct disk* disk, int cluster, u32 value)
 {
-    struct fat16_data* data = disk->data;
-    struct disk_stream* stream = data->read_cluster_streamer;
-    if (!stream)
+    struct fat16_data* data = (struct fat16_data*)disk->data;
+    u8* entry = get_cached_entry(disk, cluster);
+    if(!entry)
     {
         return -EIO;
     }
 
-    return read_data_from_stream(disk, stream, cluster, offset, total, out);
+    if(data->type == FAT_TYPE_32)
+    {
+        *(u32*)entry = (*(u32*)entry & ~FAT32_CLUSTER_MASK) | (value & FAT32_CLUSTER_MASK);
+    } else {
+        *(u16*)entry = (u16)value;
+    }
+    data->fat_cache.dirty = true;
+    return 0;
 }
 
-void free_fat16_item(struct fat16_item* item)
+/**
+ * @brief Get the next cluster in a cluster chain
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param cluster int - The current cluster
+ * @return int - The next cluster, 0 if cluster is the last one, otherwise return an error code
+ */
+static int get_next_cluster(struct disk* disk, int cluster)
 {
-    if(item->type == FAT16_ITEM_TYPE_DIRECTORY)
+    int entry = get_entry(disk, cluster);
+    if(entry < 0)
     {
-        kfree(item->directory->entries);
+        return entry;
     }
-}
 
-void free_fat16_directory(struct fat16_directory* dir){
-    if (!dir)
+    if(entry >= FAT_END_OF_CHAIN)
     {
-        return;
+        return 0;
     }
 
-    if (dir->entries)
+    // Free, reserved or bad clusters can not be part of a chain
+    if(entry == FAT_FREE_CLUSTER || entry == 0x0001 || entry == FAT_BAD_CLUSTER)
     {
-        kfree(dir->entries);
+        return -EIO;
     }
 
-    kfree(dir);
+    return entry;
 }
 
 /**
- * @brief Load a fat16 directory from a fat16 entry
+ * @brief Write the FAT cache back and let the driver record the free cluster count(FAT32 FSInfo)
  * @param disk struct disk* - The disk that the filesystem is on
- * @param entry struct fat16_entry* - The entry to load the directory from
- * @return struct fat16_directory* - The loaded directory
- 
+ * @return int - 0 if success, otherwise return an error code
  */
-struct fat16_directory* load_fat16_directory(struct disk* disk, struct fat16_entry* entry)
+static int flush_fat(struct disk* disk)
 {
-    struct fat16_directory* dir = (struct fat16_directory*)kmalloc(sizeof(struct fat16_directory));
-    if (!dir)
+    struct fat16_data* data = (struct fat16_data*)disk->data;
+    int res = flush_fat_cache(disk);
+    if(res == 0 && data->sync_info && data->synced_free_clusters != data->free_map.free_clusters)
     {
-        return 0;
+        res = data->sync_info(disk, data->info_sector, data->free_map.free_clusters, data->free_map.next_free);
+        if(res == 0)
+        {
+            data->synced_free_clusters = data->free_map.free_clusters;
+        }
     }
 
-    // Get the first cluster of the directory 
-    // The first cluster is the starting cluster of a new directory(like the root directory)
-    // Subdirectory is essentially an array of fat16 entries
-    int cluster = get_first_cluster(entry); 
+    return res;
+}
 
-    int sector = cluster_to_sector(disk->data, cluster); // Get the sector of the cluster
-    int total_entries = get_total_entries(disk, sector);
-    dir->totel_entries = total_entries;
-    int dir_size = total_entries * sizeof(struct fat16_entry);
+static bool is_cluster_used(struct fat16_free_map* free_map, u32 cluster)
+{
+    return (free_map->map[cluster / 32] >> (cluster % 32)) & 1;
+}
 
-    // Load the entire directory into memory
-    dir->entries = (struct fat16_entry*)kmalloc(dir_size);
-    if(!dir->entries)
-    {
-        kfree(dir);
-        return 0;
-    }
-    
-    
-    if(read_internal_data(disk, cluster, 0x00, dir_size, dir->entries) < 0)
+static void mark_cluster(struct fat16_free_map* free_map, u32 cluster, bool used)
+{
+    if(used)
     {
-        kfree(dir->entries);
-        kfree(dir);
-        return 0;
+        free_map->map[cluster / 32] |= (1 << (cluster % 32));
+        free_map->free_clusters --;
+    } else {
+        free_map->map[cluster / 32] &= ~(1 << (cluster % 32));
+        free_map->free_clusters ++;
     }
-
-    return dir;
 }
 
 /**
- * @brief Create a fat16 item(For fat16_filedescriptor) for a directory
+ * @brief Build the free cluster bitmap from the FAT
  * @param disk struct disk* - The disk that the filesystem is on
- * @param entry struct fat16_entry* - The entry to create the item from
- * @return struct fat16_item* - The created item
- 
+ * @param data struct fat16_data* - The fat16 data structure, its layout must be set
+ * @return int - 0 if success, otherwise return an error code
  */
-struct fat16_item* create_fat_item_for_directory(struct disk* disk, struct fat16_entry* entry)
+static int init_free_map(struct disk* disk, struct fat16_data* data)
 {
-    struct fat16_item* item = (struct fat16_item*)kmalloc(sizeof(struct fat16_item));
-    if(!item){
-        return 0;
+    struct fat16_free_map* free_map = &data->free_map;
+    struct fat_header* header = &data->header.header;
+
+    u32 total_sectors = header->total_sectors ? header->total_sectors : header->total_sectors_large;
+    u32 total_clusters = (total_sectors - data->data_sector) / header->sectors_per_cluster + 2;
+    u32 fat_entries = data->fat_sectors * disk->sector_size / (data->type == FAT_TYPE_32 ? FAT32_ENRTY_SIZE : FAT16_ENRTY_SIZE);
+    if(total_clusters > fat_entries)
+    {
+        total_clusters = fat_entries;
     }
 
-    if(entry->attr & FAT16_FILE_SUBDIRECTORY)
+    u32 map_size = (total_clusters + 31) / 32 * sizeof(u32);
+    free_map->map = (u32*)kmalloc(map_size);
+    if(!free_map->map)
     {
-        item->type = FAT16_ITEM_TYPE_DIRECTORY;
-        item->directory = load_fat16_directory(disk, entry); // Load in the directory
-    } else {
-        item->type = FAT16_ITEM_TYPE_FILE;
-        item->entry = clone_fat16_entry(entry, sizeof(struct fat16_entry)); // Clone the file entry into the item structure
+        return -ENOMEM;
     }
+    memset(free_map->map, 0x00, map_size);
 
-    return item;
-}
+    free_map->total_clusters = total_clusters;
+    free_map->free_clusters = total_clusters;
+    free_map->next_free = 2;
 
-/**
- * Find an item in the root directory
- * @param[in] disk struct disk* - The disk that the filesystem is on
- * @param[in] dir struct fat16_directory* - The directory to search in
- * @param[in] name const char* - The name of the item to find
- 
- */
-struct fat16_item* find_item_in_root_directory(struct disk* disk, struct fat16_directory* dir, const char* name)
-{
-    for (int i = 0; i < dir->totel_entries; i++)
+    // Cluster 0 and 1 are reserved
+    mark_cluster(free_map, 0, true);
+    mark_cluster(free_map, 1, true);
+    for(u32 cluster = 2; cluster < total_clusters; cluster++)
     {
-        struct fat16_entry* entry = &dir->entries[i];
-        char filename[MAX_PATH_LEN];
-        get_full_filename(entry, filename, sizeof(filename));
-        if(strcmp_prefix_ignore_case(filename, name, sizeof(name)) == 0)
+        int entry = get_entry(disk, cluster);
+        if(entry < 0)
         {
-            return create_fat_item_for_directory(disk, entry);
+            kfree(free_map->map);
+            free_map->map = 0;
+            return entry;
+        }
+
+        if(entry != FAT_FREE_CLUSTER)
+        {
+            mark_cluster(free_map, cluster, true);
         }
     }
 
@@ -657,118 +805,1467 @@ struct fat16_item* find_item_in_root_directory(struct disk* disk, struct fat16_d
 }
 
 /**
- * Get the item in the directory
- * @param[in] disk struct disk* - The disk that the filesystem is on
- * @param[in] path struct path_part* - The path to the item
- * @return struct fat16_item* - The item in the root directory
+ * @brief Find a run of free clusters
+ * A run starting at goal is preferred so a file grows in place,
+ * otherwise the first run of the wanted length is used, or the longest run if there is none
+ * @param free_map struct fat16_free_map* - The free cluster bitmap
+ * @param goal u32 - The preferred first cluster, 0 for no preference
+ * @param want u32 - The number of clusters wanted
+ * @param[out] run_length u32* - The length of the run found(at most want)
+ * @return int - The first cluster of the run, -ENOSPC if the disk is full
  */
-struct fat16_item* get_root_directory_item(struct disk* disk, struct path_part* path)
+static int find_free_run(struct fat16_free_map* free_map, u32 goal, u32 want, u32* run_length)
 {
-    struct fat16_data* data = disk->data;
-    struct fat16_item* root_item = find_item_in_root_directory(disk, &data->root, path->part); // Find the item in the root directory
-    if(!root_item)
+    if(goal >= 2 && goal < free_map->total_clusters && !is_cluster_used(free_map, goal))
     {
-        return 0;
+        u32 len = 0;
+        while(len < want && goal + len < free_map->total_clusters && !is_cluster_used(free_map, goal + len))
+        {
+            len ++;
+        }
+
+        *run_length = len;
+        return goal;
     }
 
-    struct path_part* next = path->next; // Get the next part of the path
-    struct fat16_item* current = root_item; // Set the current item to the root item(Maybe a directory or a file)
-    while(next)
+    u32 best_start = 0;
+    u32 best_len = 0;
+    u32 start = 0;
+    u32 len = 0;
+    for(u32 cluster = 2; cluster < free_map->total_clusters; cluster++)
     {
-        if(current->type != FAT16_ITEM_TYPE_DIRECTORY) // If the current item is not a directory and has a subdirectory, return 0
+        // Skip 32 used clusters at once
+        if(cluster % 32 == 0 && free_map->map[cluster / 32] == 0xFFFFFFFF)
         {
-            free_fat16_item(current);
-            return 0;
+            len = 0;
+            cluster += 31;
+            continue;
         }
 
-        struct fat16_item* next_item = find_item_in_root_directory(disk, current->directory, next->part); // Find the next item in the current directory
-        if(!next_item)
+        if(is_cluster_used(free_map, cluster))
         {
-            free_fat16_item(current);
-            return 0;
+            len = 0;
+            continue;
+        }
+
+        if(len == 0)
+        {
+            start = cluster;
+        }
+        len ++;
+
+        if(len > best_len)
+        {
+            best_start = start;
+            best_len = len;
         }
 
-        free_fat16_item(current);
-        current = next_item; // Set the current item to the next item
-        next = next->next;
+        if(len == want)
+        {
+            break;
+        }
+    }
+
+    if(best_len == 0)
+    {
+        return -ENOSPC;
     }
 
-    return current; // Return the current item
+    *run_length = best_len;
+    return best_start;
 }
 
 /**
- * @brief Fat16 filesystem's open method for opening a file, returns its file descriptor
+ * @brief Allocate clusters and append them to a cluster chain
+ * Runs of physically contiguous clusters are preferred, starting right after the last cluster of the chain
  * @param disk struct disk* - The disk that the filesystem is on
- * @param path struct path_part* - The path to the file
- * @param mode FILE_OPEN_MODE - The mode to open the file in(not implemented yet)
- * @return void* - The file descriptor of the opened file(fat16_file_descriptor*)
- 
+ * @param last_cluster int - The last cluster of the chain, 0 to start a new chain
+ * @param total u32 - The number of clusters to allocate
+ * @param[out] first_cluster int* - The first cluster allocated
+ * @return int - The new last cluster of the chain, otherwise return an error code
  */
-void* fat16_open_file(struct disk* disk, struct path_part* path, FILE_OPEN_MODE mode)
+static int allocate_clusters(struct disk* disk, int last_cluster, u32 total, int* first_cluster)
 {
-    struct fat16_item* item = get_root_directory_item(disk, path); // Get the item in the root directory
-    if(!item)
+    struct fat16_data* data = disk->data;
+    struct fat16_free_map* free_map = &data->free_map;
+    *first_cluster = 0;
+
+    if(total > free_map->free_clusters)
     {
-        return 0;
+        return -ENOSPC;
     }
 
-    if(item->type != FAT16_ITEM_TYPE_FILE) // If the item is not a file, free the invalid item and return 0
+    while(total > 0)
     {
-        free_fat16_item(item);
-        return 0;
+        u32 goal = last_cluster ? last_cluster + 1 : free_map->next_free;
+        u32 len = 0;
+        int start = find_free_run(free_map, goal, total, &len);
+        if(start < 0)
+        {
+            return start;
+        }
+
+        // Link the run together and terminate it
+        for(u32 i = 0; i < len; i++)
+        {
+            mark_cluster(free_map, start + i, true);
+            u32 next = (i + 1 == len) ? FAT_END_OF_CHAIN_MARK : start + i + 1;
+            if(set_entry(disk, start + i, next) != 0)
+            {
+                return -EIO;
+            }
+        }
+
+        if(last_cluster)
+        {
+            if(set_entry(disk, last_cluster, start) != 0)
+            {
+                return -EIO;
+            }
+        }
+
+        if(!*first_cluster)
+        {
+            *first_cluster = start;
+        }
+
+        last_cluster = start + len - 1;
+        total -= len;
+    }
+
+    free_map->next_free = last_cluster + 1;
+    return last_cluster;
+}
+
+/**
+ * @brief Give every cluster of a chain back to the free map
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param cluster int - The first cluster of the chain
+ * @return int - 0 if success, otherwise return an error code
+ */
+static int free_cluster_chain(struct disk* disk, int cluster)
+{
+    struct fat16_data* data = disk->data;
+    while(cluster > 0)
+    {
+        int next = get_next_cluster(disk, cluster);
+        if(set_entry(disk, cluster, FAT_FREE_CLUSTER) != 0)
+        {
+            return -EIO;
+        }
+        mark_cluster(&data->free_map, cluster, false);
+        if((u32)cluster < data->free_map.next_free)
+        {
+            data->free_map.next_free = cluster;
+        }
+        cluster = next;
+    }
+
+    return cluster;
+}
+
+/**
+ * @brief Get the last cluster of a chain and its length
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param cluster int - The first cluster of the chain
+ * @param[out] length u32* - The number of clusters in the chain
+ * @return int - The last cluster, otherwise return an error code
+ */
+static int get_last_cluster(struct disk* disk, int cluster, u32* length)
+{
+    *length = 1;
+    int next = get_next_cluster(disk, cluster);
+    while(next > 0)
+    {
+        cluster = next;
+        (*length) ++;
+        next = get_next_cluster(disk, cluster);
+    }
+
+    return next < 0 ? next : cluster;
+}
+
+/**
+ * @brief Get the cluster to use based on the cluster and offset
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param cluster int - The current cluster
+ * @return int - The next cluster in the chain
+ 
+ */
+static int get_cluster_for_offset(struct disk* disk, int starting_cluster, int offset)
+{ 
+    struct fat16_data* data = disk->data;
+    int cluster_size = data->header.header.sectors_per_cluster * disk->sector_size;
+    int cluster_to_use = starting_cluster;
+    int clusters_ahead = offset / cluster_size; // Get the number of clusters ahead to read
+    for (int i = 0; i < clusters_ahead; i++)
+    {
+        int next = get_next_cluster(disk, cluster_to_use);
+        if (next <= 0) // Error or the chain ends before the offset
+        {
+            return -EIO;
+        }
+
+        cluster_to_use = next;
+    }
+
+    return cluster_to_use;
+}
+
+/**
+ * @brief Follow a cluster chain while the clusters are physically adjacent
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param cluster int - The first cluster of the run
+ * @param max_bytes int - Stop once the run holds at least this many bytes
+ * @param first_bytes int - The bytes of the first cluster that count towards max_bytes
+ * @param[out] run_bytes int* - The bytes covered by the run(first_bytes plus whole clusters)
+ * @return int - The last cluster of the run
+ */
+static int get_contiguous_run(struct disk* disk, int cluster, int max_bytes, int first_bytes, int* run_bytes)
+{
+    struct fat16_data* data = disk->data;
+    int cluster_size = data->header.header.sectors_per_cluster * disk->sector_size;
+    int last = cluster;
+    *run_bytes = first_bytes;
+    while(*run_bytes < max_bytes)
+    {
+        int next = get_next_cluster(disk, last);
+        if(next != last + 1)
+        {
+            break;
+        }
+        last = next;
+        *run_bytes += cluster_size;
+    }
+
+    return last;
+}
+
+/**
+ * @brief Move data between the clusters of a file and a list of buffers with one pass over the cluster chain
+ * Each run of physically contiguous clusters is looked up once,
+ * the buffers it covers are filled(or written out) one after another with one stream request each
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param cluster int - The first cluster of the file
+ * @param offset int - The offset within the file to start at
+ * @param iov const struct iovec* - The buffers
+ * @param total int - The total bytes to move, at most the size of all buffers
+ * @param write bool - Write the buffers to the disk instead of reading into them
+ * @return int - 0 if success, otherwise return an error code
+ * @attention The clusters must already be allocated
+ */
+static int transfer_internal_data(struct disk* disk, int cluster, int offset, const struct iovec* iov, int total, bool write)
+{
+    struct fat16_data* data = disk->data;
+    struct disk_stream* stream = write ? data->write_streamer : data->read_cluster_streamer;
+    int cluster_size = data->header.header.sectors_per_cluster * disk->sector_size;
+    if(!stream)
+    {
+        return -EIO;
+    }
+
+    if(total <= 0)
+    {
+        return 0;
+    }
+
+    int cluster_to_use = get_cluster_for_offset(disk, cluster, offset);
+    if(cluster_to_use < 0)
+    {
+        return cluster_to_use;
+    }
+
+    u32 iov_offset = 0; // The bytes of *iov already done
+    while(total > 0)
+    {
+        int cluster_offset = offset % cluster_size;
+        int run_bytes = 0;
+        int last = get_contiguous_run(disk, cluster_to_use, total, cluster_size - cluster_offset, &run_bytes);
+        int run_total = total > run_bytes ? run_bytes : total;
+        u64 start_pos = sector_to_address(disk, cluster_to_sector(data, cluster_to_use)) + cluster_offset;
+        if(seek_disk_stream(stream, start_pos) != 0)
+        {
+            return -EIO;
+        }
+
+        // The stream position carries over from one buffer to the next
+        while(run_total > 0)
+        {
+            if(iov_offset == iov->len)
+            {
+                iov ++;
+                iov_offset = 0;
+                continue;
+            }
+
+            int len = iov->len - iov_offset;
+            if(len > run_total)
+            {
+                len = run_total;
+            }
+
+            char* buf = (char*)iov->base + iov_offset;
+            int res = write ? write_disk_stream(stream, len, buf) : read_disk_stream(stream, len, buf);
+            if(res != 0)
+            {
+                return -EIO;
+            }
+
+            iov_offset += len;
+            run_total -= len;
+            total -= len;
+            offset += len;
+        }
+
+        if(total > 0)
+        {
+            // Continue with the cluster after the run
+            cluster_to_use = get_next_cluster(disk, last);
+            if(cluster_to_use <= 0)
+            {
+                return -EIO;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void free_fat16_directory(struct fat16_directory* dir){
+    if (!dir)
+    {
+        return;
+    }
+
+    if (dir->entries)
+    {
+        kfree(dir->entries);
+    }
+
+    kfree(dir);
+}
+
+void free_fat16_item(struct fat16_item* item)
+{
+    if(item->type == FAT16_ITEM_TYPE_DIRECTORY)
+    {
+        free_fat16_directory(item->directory);
+    } else if(item->entry) {
+        kfree(item->entry);
+    }
+
+    kfree(item);
+}
+
+/**
+ * @brief Create a fat16 item(For fat16_filedescriptor) for a file
+ * @param entry struct fat16_entry* - The directory entry of the file, copied into the item
+ * @param position u64 - The byte address of the entry on the disk
+ * @return struct fat16_item* - The created item, 0 if out of memory
+ */
+static struct fat16_item* create_fat_item_for_file(struct fat16_entry* entry, u64 position)
+{
+    struct fat16_item* item = (struct fat16_item*)kmalloc(sizeof(struct fat16_item));
+    if(!item){
+        return 0;
+    }
+
+    item->type = FAT16_ITEM_TYPE_FILE;
+    item->entry = clone_fat16_entry(entry, sizeof(struct fat16_entry)); // Clone the file entry into the item structure
+    item->entry_position = position;
+    if(!item->entry)
+    {
+        kfree(item);
+        return 0;
+    }
+
+    return item;
+}
+
+/**
+ * @brief Open a stream over the entries of a directory
+ * The FAT16 root directory is served from its in-memory copy,
+ * other directories are read one cluster at a time into a buffer of constant size
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param cluster int - The first cluster of the directory, 0 for the root directory
+ * @param[out] stream struct fat16_dir_stream* - The stream to initialize
+ * @return int - 0 if success, otherwise return an error code
+ */
+static int open_dir_stream(struct disk* disk, int cluster, struct fat16_dir_stream* stream)
+{
+    struct fat16_data* data = disk->data;
+    memset(stream, 0x00, sizeof(struct fat16_dir_stream));
+    if(cluster == 0)
+    {
+        cluster = data->root_cluster;
+    }
+    stream->disk = disk;
+    stream->cluster = cluster;
+
+    if(cluster == 0)
+    {
+        stream->entries = data->root.entries;
+        stream->total = data->root.totel_entries;
+        return 0;
+    }
+
+    int sectors_per_cluster = data->header.header.sectors_per_cluster;
+    stream->buffer = (struct fat16_entry*)kmalloc(sectors_per_cluster * disk->sector_size);
+    if(!stream->buffer)
+    {
+        return -ENOMEM;
+    }
+
+    if(read_disk_block(disk, cluster_to_sector(data, cluster), sectors_per_cluster, stream->buffer) != 0)
+    {
+        kfree(stream->buffer);
+        stream->buffer = 0;
+        return -EIO;
+    }
+
+    stream->entries = stream->buffer;
+    stream->total = sectors_per_cluster * disk->sector_size / sizeof(struct fat16_entry);
+    return 0;
+}
+
+static void close_dir_stream(struct fat16_dir_stream* stream)
+{
+    if(stream->buffer)
+    {
+        kfree(stream->buffer);
+        stream->buffer = 0;
+    }
+}
+
+/**
+ * @brief Get the next entry of a directory stream, skipping deleted, long name and volume label entries
+ * @param stream struct fat16_dir_stream* - The stream
+ * @param[out] entry struct fat16_entry** - Points to the entry inside the stream buffer, valid until the next call
+ * @param[out] position u64* - The byte address of the entry on the disk
+ * @return int - 1 if an entry is returned, 0 at the end of the directory, otherwise return an error code
+ */
+static int read_dir_stream(struct fat16_dir_stream* stream, struct fat16_entry** entry, u64* position)
+{
+    struct disk* disk = stream->disk;
+    struct fat16_data* data = disk->data;
+    while(1)
+    {
+        if(stream->index == stream->total)
+        {
+            if(stream->cluster == 0) // The root directory has a fixed size
+            {
+                return 0;
+            }
+
+            int next = get_next_cluster(disk, stream->cluster);
+            if(next <= 0)
+            {
+                return next;
+            }
+
+            int sectors_per_cluster = data->header.header.sectors_per_cluster;
+            if(read_disk_block(disk, cluster_to_sector(data, next), sectors_per_cluster, stream->buffer) != 0)
+            {
+                return -EIO;
+            }
+            stream->cluster = next;
+            stream->index = 0;
+        }
+
+        struct fat16_entry* current = &stream->entries[stream->index];
+        if(current->name[0] == FAT16_ENTRY_END)
+        {
+            stream->index = stream->total;
+            stream->cluster = 0;
+            return 0;
+        }
+
+        int index = stream->index ++;
+        if(current->name[0] == FAT16_ENTRY_DELETED || current->attr == FAT16_ATTR_LONG_NAME || (current->attr & FAT16_FILE_VOLUME_LABEL))
+        {
+            continue;
+        }
+
+        u32 first_sector = stream->cluster ? cluster_to_sector(data, stream->cluster) : data->root.sector_begin;
+        *position = sector_to_address(disk, first_sector) + index * sizeof(struct fat16_entry);
+        *entry = current;
+        return 1;
+    }
+}
+
+/**
+ * Find an entry in a directory by streaming over it
+ * @param[in] disk struct disk* - The disk that the filesystem is on
+ * @param[in] cluster int - The first cluster of the directory, 0 for the root directory
+ * @param[in] name struct path_part* - The name of the item to find, a span of the path
+ * @param[out] entry struct fat16_entry* - The entry found
+ * @param[out] position u64* - The byte address of the entry on the disk
+ * @return int - 0 if the entry is found, otherwise return an error code
+ */
+static int find_entry_in_directory(struct disk* disk, int cluster, struct path_part* name, struct fat16_entry* entry, u64* position)
+{
+    struct fat16_dir_stream stream;
+    int res = open_dir_stream(disk, cluster, &stream);
+    if(res < 0)
+    {
+        return res;
+    }
+
+    struct fat16_entry* current = 0;
+    while((res = read_dir_stream(&stream, &current, position)) > 0)
+    {
+        char filename[MAX_PATH_LEN];
+        get_full_filename(current, filename, sizeof(filename));
+        if(strlen(filename) == name->len && strcmp_prefix_ignore_case(filename, name->part, name->len) == 0)
+        {
+            *entry = *current;
+            break;
+        }
+    }
+
+    close_dir_stream(&stream);
+    if(res == 0)
+    {
+        return -ENOENT;
+    }
+
+    return res < 0 ? res : 0;
+}
+
+/**
+ * Follow a path from the root directory to an entry, one directory cluster in memory at a time
+ * @param[in] disk struct disk* - The disk that the filesystem is on
+ * @param[in] path struct path_part* - The path to the item
+ * @param[in] stop struct path_part* - The part to stop before, 0 to follow the whole path
+ * @param[out] entry struct fat16_entry* - The entry of the last part followed
+ * @param[out] position u64* - The byte address of the entry on the disk
+ * @return int - 0 if the entry is found, otherwise return an error code
+ */
+static int find_path_entry(struct disk* disk, struct path_part* path, struct path_part* stop, struct fat16_entry* entry, u64* position)
+{
+    int cluster = 0;
+    struct path_part* part = path;
+    while(1)
+    {
+        int res = find_entry_in_directory(disk, cluster, part, entry, position);
+        if(res < 0)
+        {
+            return res;
+        }
+
+        part = part->next;
+        if(part == stop)
+        {
+            return 0;
+        }
+
+        if(!(entry->attr & FAT16_FILE_SUBDIRECTORY)) // Only a directory can have a next part
+        {
+            return -ENOTDIR;
+        }
+        cluster = get_first_cluster(entry); // ".." of a first level directory is 0, the root
+    }
+}
+
+/**
+ * @brief Convert a file name to the space padded 8.3 form of a fat16 entry
+ * @param part struct path_part* - The file name, e.g. "log.txt", a span of the path
+ * @param[out] entry struct fat16_entry* - The entry to fill name and ext of
+ * @return int - 0 if success, -EINVAPTH if the name does not fit 8.3
+ */
+static int string_to_fat16_filename(struct path_part* part, struct fat16_entry* entry)
+{
+    memset(entry->name, 0x20, sizeof(entry->name));
+    memset(entry->ext, 0x20, sizeof(entry->ext));
+
+    const char* name = part->part;
+    const char* end = part->part + part->len;
+    int len = 0;
+    while(name < end && *name != '.')
+    {
+        if(len == sizeof(entry->name))
+        {
+            return -EINVAPTH;
+        }
+        entry->name[len++] = toupper(*name++);
+    }
+
+    if(len == 0 || (u8)entry->name[0] == FAT16_ENTRY_DELETED)
+    {
+        return -EINVAPTH;
+    }
+
+    if(name < end && *name == '.')
+    {
+        name ++;
+        len = 0;
+        while(name < end)
+        {
+            if(len == sizeof(entry->ext) || *name == '.')
+            {
+                return -EINVAPTH;
+            }
+            entry->ext[len++] = toupper(*name++);
+        }
+    }
+
+    return 0;
+}
+
+static void set_first_cluster(struct fat16_entry* entry, u32 cluster)
+{
+    entry->first_cluster_high = (u16)(cluster >> 16);
+    entry->first_cluster_low = (u16)cluster;
+}
+
+/**
+ * @brief Write a directory entry to its location on the disk
+ * The in-memory copy of the root directory is kept in sync
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param position u64 - The byte address of the entry
+ * @param entry struct fat16_entry* - The entry to write
+ * @return int - 0 if success, otherwise return an error code
+ */
+static int write_directory_entry(struct disk* disk, u64 position, struct fat16_entry* entry)
+{
+    struct fat16_data* data = disk->data;
+    struct disk_stream* stream = data->write_streamer;
+    if(seek_disk_stream(stream, position) != 0 || write_disk_stream(stream, sizeof(struct fat16_entry), entry) != 0)
+    {
+        return -EIO;
+    }
+
+    struct fat16_directory* root = &data->root;
+    u64 root_position = sector_to_address(disk, root->sector_begin);
+    if(root->entries && position >= root_position && position < root_position + root->max_entries * sizeof(struct fat16_entry))
+    {
+        int index = (position - root_position) / sizeof(struct fat16_entry);
+        root->entries[index] = *entry;
+        if(index == root->totel_entries)
+        {
+            root->totel_entries ++;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Write zeros over whole clusters, used for new directory clusters
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param cluster int - The first cluster to clear
+ * @param total int - The number of contiguous clusters to clear
+ * @return int - 0 if success, otherwise return an error code
+ */
+static int clear_clusters(struct disk* disk, int cluster, int total)
+{
+    struct fat16_data* data = disk->data;
+    int sectors = data->header.header.sectors_per_cluster * total;
+    char* zeros = (char*)kmalloc(sectors * disk->sector_size);
+    if(!zeros)
+    {
+        return -ENOMEM;
+    }
+
+    memset(zeros, 0x00, sectors * disk->sector_size);
+    int res = write_disk_block(disk, cluster_to_sector(data, cluster), sectors, zeros);
+    kfree(zeros);
+    return res;
+}
+
+/**
+ * @brief Find a slot for a new entry by streaming over a directory, growing the directory by a cluster if it is full
+ * Deleted entries and the end marker are free, only one cluster of the directory is in memory at a time
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param cluster int - The first cluster of the directory, 0 for the root directory
+ * @param[out] position u64* - The byte address of the free slot
+ * @return int - 0 if success, otherwise return an error code
+ */
+static int find_free_directory_slot(struct disk* disk, int cluster, u64* position)
+{
+    struct fat16_data* data = disk->data;
+    struct fat16_dir_stream stream;
+    int res = open_dir_stream(disk, cluster, &stream);
+    if(res < 0)
+    {
+        return res;
+    }
+
+    while(1)
+    {
+        if(stream.index == stream.total)
+        {
+            if(stream.cluster == 0) // The FAT16 root directory has a fixed size, the stream stops at its end marker
+            {
+                res = data->root.totel_entries < data->root.max_entries ? 0 : -ENOSPC;
+                *position = sector_to_address(disk, data->root.sector_begin) + stream.index * sizeof(struct fat16_entry);
+                break;
+            }
+
+            int next = get_next_cluster(disk, stream.cluster);
+            if(next == 0)
+            {
+                res = allocate_clusters(disk, stream.cluster, 1, &next);
+                if(res >= 0)
+                {
+                    res = clear_clusters(disk, next, 1);
+                }
+                *position = sector_to_address(disk, cluster_to_sector(data, next));
+                break;
+            }
+
+            int sectors_per_cluster = data->header.header.sectors_per_cluster;
+            if(next < 0 || read_disk_block(disk, cluster_to_sector(data, next), sectors_per_cluster, stream.buffer) != 0)
+            {
+                res = next < 0 ? next : -EIO;
+                break;
+            }
+            stream.cluster = next;
+            stream.index = 0;
+        }
+
+        struct fat16_entry* current = &stream.entries[stream.index];
+        if(current->name[0] == FAT16_ENTRY_END || current->name[0] == FAT16_ENTRY_DELETED)
+        {
+            u32 first_sector = stream.cluster ? cluster_to_sector(data, stream.cluster) : data->root.sector_begin;
+            *position = sector_to_address(disk, first_sector) + stream.index * sizeof(struct fat16_entry);
+            res = 0;
+            break;
+        }
+        stream.index ++;
+    }
+
+    close_dir_stream(&stream);
+    return res < 0 ? res : 0;
+}
+
+/**
+ * @brief Create an empty file
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param path struct path_part* - The path to the file, every directory of it must exist
+ * @return struct fat16_item* - The item of the new file
+ */
+static struct fat16_item* create_fat16_file(struct disk* disk, struct path_part* path)
+{
+    struct path_part* last = path;
+    while(last->next)
+    {
+        last = last->next;
+    }
+
+    struct fat16_entry entry;
+    memset(&entry, 0x00, sizeof(entry));
+    if(string_to_fat16_filename(last, &entry) != 0)
+    {
+        return 0;
+    }
+    entry.attr = FAT16_FILE_ARCHIVED;
+
+    int cluster = 0; // The root directory
+    if(last != path)
+    {
+        struct fat16_entry parent;
+        u64 parent_position = 0;
+        if(find_path_entry(disk, path, last, &parent, &parent_position) != 0 || !(parent.attr & FAT16_FILE_SUBDIRECTORY))
+        {
+            return 0;
+        }
+        cluster = get_first_cluster(&parent);
+    }
+
+    struct fat16_item* item = 0;
+    u64 position = 0;
+    if(find_free_directory_slot(disk, cluster, &position) == 0 && write_directory_entry(disk, position, &entry) == 0)
+    {
+        item = create_fat_item_for_file(&entry, position);
+    }
+
+    flush_fat(disk);
+    return item;
+}
+
+/**
+ * @brief Add the vnode of a file that is not open yet
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param item struct fat16_item* - The item of the file, owned by the vnode from now on
+ * @return struct vnode* - The vnode, 0 if out of memory or vnodes(the item is freed)
+ */
+static struct vnode* open_file_vnode(struct disk* disk, struct fat16_item* item)
+{
+    struct fat16_file* file = (struct fat16_file*)kmalloc(sizeof(struct fat16_file));
+    if(!file)
+    {
+        free_fat16_item(item);
+        return 0;
+    }
+
+    file->item = item;
+    file->dirty = false;
+    file->unlinked = false;
+    file->reserved = false;
+    struct vnode* vnode = vnode_create(disk, item->entry_position, file);
+    if(!vnode)
+    {
+        free_fat16_item(item);
+        kfree(file);
+    }
+
+    return vnode;
+}
+
+static int release_file_clusters(struct disk* disk, struct fat16_file* file, u32 keep);
+
+/**
+ * @brief Drop a reference to the vnode of a file, the last one frees the shared state
+ * The clusters of a file unlinked while it was open are freed here,
+ * and so are the clusters reserved past the end of the file, every descriptor that could still write them is gone
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param vnode struct vnode* - The vnode of the file
+ * @return int - 0 if success, otherwise return an error code
+ */
+static int put_file_vnode(struct disk* disk, struct vnode* vnode)
+{
+    struct fat16_file* file = (struct fat16_file*)vnode->data;
+    if(vnode_put(vnode) > 0)
+    {
+        return 0;
+    }
+
+    int res = 0;
+    int cluster = get_first_cluster(file->item->entry);
+    if(file->unlinked && cluster != 0)
+    {
+        res = free_cluster_chain(disk, cluster);
+        if(res == 0)
+        {
+            res = flush_fat(disk);
+        }
+    } else if(!file->unlinked && file->reserved) {
+        struct fat16_data* data = disk->data;
+        u32 cluster_size = data->header.header.sectors_per_cluster * disk->sector_size;
+        res = release_file_clusters(disk, file, (file->item->entry->size + cluster_size - 1) / cluster_size);
+        if(res == 0 && file->dirty && write_directory_entry(disk, file->item->entry_position, file->item->entry) != 0)
+        {
+            res = -EIO;
+        }
+        if(res == 0)
+        {
+            res = flush_fat(disk);
+        }
+    }
+
+    free_fat16_item(file->item);
+    kfree(file);
+    return res;
+}
+
+/**
+ * @brief Fat16 filesystem's open method for opening a file, returns its file descriptor
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param path struct path_part* - The path to the file
+ * @param mode FILE_OPEN_MODE - The mode to open the file in, "w" and "a" create the file if it does not exist
+ * @return void* - The file descriptor of the opened file(fat16_file_descriptor*)
+ 
+ */
+void* fat16_open_file(struct disk* disk, struct path_part* path, FILE_OPEN_MODE mode)
+{
+    struct fat16_entry entry;
+    u64 position = 0;
+    struct fat16_item* item = 0;
+    struct vnode* vnode = 0;
+    int res = find_path_entry(disk, path, 0, &entry, &position);
+    if(res == 0)
+    {
+        if(entry.attr & FAT16_FILE_SUBDIRECTORY)
+        {
+            return 0;
+        }
+
+        if(mode != FILE_MODE_READ && (entry.attr & FAT16_FILE_READ_ONLY))
+        {
+            return 0;
+        }
+
+        vnode = vnode_get(disk, position); // Share the entry with the descriptors that have the file open
+        if(!vnode)
+        {
+            item = create_fat_item_for_file(&entry, position);
+        }
+    } else if(res == -ENOENT && mode != FILE_MODE_READ) {
+        // Only a missing name is created, an I/O error must not add a second entry for an existing file
+        item = create_fat16_file(disk, path);
+    }
+
+    if(!vnode && item)
+    {
+        vnode = open_file_vnode(disk, item);
+    }
+
+    if(!vnode)
+    {
+        return 0;
+    }
+
+    struct fat16_file_descriptor* fd = (struct fat16_file_descriptor*)kmalloc(sizeof(struct fat16_file_descriptor));
+    if(!fd)
+    {
+        put_file_vnode(disk, vnode);
+        return 0;
+    }
+
+    fd->vnode = vnode;
+    fd->file = (struct fat16_file*)vnode->data;
+    fd->offset = 0; // Set the offset of the file descriptor to 0(Start reading from the beginning of the file)
+    fd->mode = mode;
+    fd->disk = disk;
+
+    if(mode == FILE_MODE_WRITE && fd->file->item->entry->size > 0)
+    {
+        if(fat16_truncate(disk, fd, 0) < 0)
+        {
+            put_file_vnode(disk, vnode);
+            kfree(fd);
+            return 0;
+        }
+    } else if(mode == FILE_MODE_APPEND) {
+        fd->offset = fd->file->item->entry->size;
+    }
+
+    return fd;
+}
+
+/**
+ * @brief The page cache identity of a file, the location of its directory entry
+ */
+static u64 get_file_id(struct fat16_file_descriptor* descriptor)
+{
+    return descriptor->vnode->id;
+}
+
+/**
+ * @brief Read the pages first to last of a file into the page cache if they are not cached yet, and hold them all
+ * Each run of missing pages is read with one pass over the cluster chain, pages past the end of the file stay zero
+ * The caller copies the pages out and releases them, until then filling a later run can not evict an earlier page
+ * Nothing stays held on failure
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param descriptor struct fat16_file_descriptor* - The file
+ * @param first u32 - The first page index
+ * @param last u32 - The last page index, less than FAT16_PAGE_FILL_BATCH pages after first
+ * @param[out] pages struct page_cache_page** - The held pages, pages[0] is page first
+ * @return int - 0 if success, -ENOMEM if a page could not be taken from the cache, otherwise return an error code
+ */
+static int fill_file_pages(struct disk* disk, struct fat16_file_descriptor* descriptor, u32 first, u32 last, struct page_cache_page** pages)
+{
+    struct fat16_entry* entry = descriptor->file->item->entry;
+    u64 id = get_file_id(descriptor);
+    struct iovec iov[FAT16_PAGE_FILL_BATCH];
+    int res = 0;
+
+    u32 index = first;
+    u32 start = first;
+    while(index <= last)
+    {
+        struct page_cache_page* page = page_cache_get(disk, id, index);
+        if(page)
+        {
+            pages[index - first] = page;
+            index ++;
+            continue;
+        }
+
+        start = index;
+        int cnt = 0;
+        while(index <= last && (cnt == 0 || !page_cache_lookup(disk, id, index)))
+        {
+            page = page_cache_alloc(disk, id, index);
+            if(!page)
+            {
+                break;
+            }
+
+            pages[index - first] = page;
+            iov[cnt].base = page->data;
+            iov[cnt].len = PAGE_SIZE;
+            cnt ++;
+            index ++;
+        }
+
+        if(cnt == 0)
+        {
+            res = -ENOMEM;
+            break;
+        }
+
+        u32 begin = start * PAGE_SIZE;
+        u32 total = entry->size > begin ? entry->size - begin : 0;
+        if(total > cnt * PAGE_SIZE)
+        {
+            total = cnt * PAGE_SIZE;
+        }
+
+        res = transfer_internal_data(disk, get_first_cluster(entry), begin, iov, total, false);
+        if(res < 0)
+        {
+            break;
+        }
+    }
+
+    for(u32 i = first; res < 0 && i < index; i++)
+    {
+        if(i >= start)
+        {
+            page_cache_drop(pages[i - first]); // The run that failed to read holds no valid data
+        }
+        page_cache_release(pages[i - first]);
+    }
+
+    return res < 0 ? res : 0;
+}
+
+/**
+ * @brief Read file data through the page cache, missing pages are read and kept for the next reader
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param descriptor struct fat16_file_descriptor* - The file
+ * @param offset u32 - The offset within the file to read from
+ * @param iov const struct iovec* - The buffers to fill
+ * @param total u32 - The total bytes to read, the range must be within the file
+ * @return int - 0 if success, -ENOMEM if the cache has no room for a batch, otherwise return an error code
+ */
+static int read_cached_data(struct disk* disk, struct fat16_file_descriptor* descriptor, u32 offset, const struct iovec* iov, u32 total)
+{
+    struct page_cache_page* pages[FAT16_PAGE_FILL_BATCH];
+    u32 iov_offset = 0;
+    while(total > 0)
+    {
+        // Fill and hold a batch of pages, they are released once copied out
+        u32 first = offset / PAGE_SIZE;
+        u32 last = (offset + total - 1) / PAGE_SIZE;
+        if(last - first >= FAT16_PAGE_FILL_BATCH)
+        {
+            last = first + FAT16_PAGE_FILL_BATCH - 1;
+        }
+
+        int res = fill_file_pages(disk, descriptor, first, last, pages);
+        if(res < 0)
+        {
+            return res;
+        }
+
+        for(u32 index = first; index <= last; index++)
+        {
+            struct page_cache_page* page = pages[index - first];
+            u32 page_offset = offset % PAGE_SIZE;
+            u32 len = PAGE_SIZE - page_offset;
+            if(len > total)
+            {
+                len = total;
+            }
+
+            total -= len;
+            offset += len;
+            while(len > 0)
+            {
+                if(iov_offset == iov->len)
+                {
+                    iov ++;
+                    iov_offset = 0;
+                    continue;
+                }
+
+                u32 piece = iov->len - iov_offset;
+                if(piece > len)
+                {
+                    piece = len;
+                }
+
+                memcpy((char*)iov->base + iov_offset, (char*)page->data + page_offset, piece);
+                iov_offset += piece;
+                page_offset += piece;
+                len -= piece;
+            }
+            page_cache_release(page);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief FAT16's read method for reading a file
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param fd void* - The file descriptor of the file to read
+ * @param size u32 - The size of each read
+ * @param nb u32 - The number of reads
+ * @param out char* - The output buffer to store the read data
+ * @return int - The number of whole elements read, fewer than nb at the end of the file
+
+ */
+int fat16_read_file(struct disk* disk, void* fd, u32 size, u32 nb, char* out)
+{
+    struct iovec iov = { .base = out, .len = size * nb };
+    int res = fat16_readv(disk, fd, &iov, 1);
+    return res < 0 ? 0 : res / size;
+}
+
+/**
+ * @brief Write data to the clusters of a file
+ * Each run of physically contiguous clusters is written with one stream request
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param cluster int - The first cluster of the file
+ * @param offset int - The offset within the file to write to
+ * @param total int - The total bytes to write
+ * @param in const char* - The data to write
+ * @return int - 0 if the data is written successfully, otherwise return an error code
+ * @attention The clusters must already be allocated
+ */
+static int write_internal_data(struct disk* disk, int cluster, int offset, int total, const char* in)
+{
+    struct iovec iov = { .base = (void*)in, .len = total };
+    return transfer_internal_data(disk, cluster, offset, &iov, total, true);
+}
+
+/**
+ * @brief Make sure a file owns enough clusters to hold size bytes
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param descriptor struct fat16_file_descriptor* - The file
+ * @param size u32 - The number of bytes the clusters must hold
+ * @return int - 0 if success, otherwise return an error code
+ */
+static int reserve_file_clusters(struct disk* disk, struct fat16_file_descriptor* descriptor, u32 size)
+{
+    struct fat16_data* data = disk->data;
+    struct fat16_entry* entry = descriptor->file->item->entry;
+    u32 cluster_size = data->header.header.sectors_per_cluster * disk->sector_size;
+    u32 needed = (size + cluster_size - 1) / cluster_size;
+
+    u32 length = 0;
+    int last_cluster = 0;
+    if(get_first_cluster(entry) != 0)
+    {
+        last_cluster = get_last_cluster(disk, get_first_cluster(entry), &length);
+        if(last_cluster < 0)
+        {
+            return last_cluster;
+        }
     }
 
-    struct fat16_file_descriptor* fd = (struct fat16_file_descriptor*)kmalloc(sizeof(struct fat16_file_descriptor));
-    if(!fd)
+    if(length >= needed)
     {
-        free_fat16_item(item);
         return 0;
     }
 
-    fd->item = item; // Set the item of the file descriptor
-    fd->offset = 0; // Set the offset of the file descriptor to 0(Start reading from the beginning of the file)
+    int first_cluster = 0;
+    descriptor->file->reserved = true;
+    int res = allocate_clusters(disk, last_cluster, needed - length, &first_cluster);
+    if(first_cluster && !last_cluster)
+    {
+        set_first_cluster(entry, first_cluster);
+        descriptor->file->dirty = true;
+    }
 
-    return fd;
+    return res < 0 ? res : 0;
 }
 
 /**
- * @brief FAT16's read method for reading a file
+ * @brief Free the clusters of a file beyond the first keep clusters
  * @param disk struct disk* - The disk that the filesystem is on
- * @param fd void* - The file descriptor of the file to read
- * @param size u32 - The size of each read
- * @param nb u32 - The number of reads
- * @param out char* - The output buffer to store the read data
- * @return int - The number of reads that were successful
+ * @param file struct fat16_file* - The file, shared by its descriptors
+ * @param keep u32 - The number of clusters to keep
+ * @return int - 0 if success, otherwise return an error code
+ */
+static int release_file_clusters(struct disk* disk, struct fat16_file* file, u32 keep)
+{
+    struct fat16_entry* entry = file->item->entry;
+    int cluster = get_first_cluster(entry);
+    if(cluster == 0)
+    {
+        return 0;
+    }
+
+    if(keep == 0)
+    {
+        set_first_cluster(entry, 0);
+        file->dirty = true;
+        return free_cluster_chain(disk, cluster);
+    }
+
+    for(u32 i = 1; i < keep; i++)
+    {
+        cluster = get_next_cluster(disk, cluster);
+        if(cluster <= 0)
+        {
+            return cluster; // The chain is already short enough
+        }
+    }
+
+    int next = get_next_cluster(disk, cluster);
+    if(next <= 0)
+    {
+        return next;
+    }
+
+    if(set_entry(disk, cluster, FAT_END_OF_CHAIN_MARK) != 0)
+    {
+        return -EIO;
+    }
+
+    return free_cluster_chain(disk, next);
+}
 
+/**
+ * @brief FAT16's write method for writing a file at its current offset
+ * The directory entry and the FAT are only updated in memory, fat16_flush() writes them back
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param fd void* - The file descriptor of the file to write
+ * @param size u32 - The size of each write
+ * @param nb u32 - The number of writes
+ * @param in const char* - The data to write
+ * @return int - The number of writes that were successful, otherwise return an error code
  */
-int fat16_read_file(struct disk* disk, void* fd, u32 size, u32 nb, char* out)
+int fat16_write_file(struct disk* disk, void* fd, u32 size, u32 nb, const char* in)
+{
+    struct iovec iov = { .base = (void*)in, .len = size * nb };
+    int res = fat16_writev(disk, fd, &iov, 1);
+    return res < 0 ? res : nb;
+}
+
+/**
+ * @brief FAT16's vectored read method, fills the buffers in order from the current offset
+ * Stops at the end of the file, the data is served from the page cache
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param private void* - The file descriptor of the file to read
+ * @param iov const struct iovec* - The buffers to fill
+ * @param iovcnt int - The number of buffers
+ * @return int - The number of bytes read, otherwise return an error code
+ */
+int fat16_readv(struct disk* disk, void* private, const struct iovec* iov, int iovcnt)
+{
+    struct fat16_file_descriptor* descriptor = (struct fat16_file_descriptor*)private;
+    struct fat16_entry* entry = descriptor->file->item->entry;
+    u32 total = 0;
+    for(int i = 0; i < iovcnt; i++)
+    {
+        total += iov[i].len;
+    }
+
+    u32 left = entry->size > descriptor->offset ? entry->size - descriptor->offset : 0;
+    if(total > left)
+    {
+        total = left;
+    }
+
+    // The pages of an unlinked file could be taken for the pages of a new file in the same directory slot
+    int res = descriptor->file->unlinked ? -ENOMEM : read_cached_data(disk, descriptor, descriptor->offset, iov, total);
+    if(res == -ENOMEM) // Every cache page is held, read around the cache
+    {
+        res = transfer_internal_data(disk, get_first_cluster(entry), descriptor->offset, iov, total, false);
+    }
+
+    if(res < 0)
+    {
+        return res;
+    }
+
+    descriptor->offset += total;
+    return total;
+}
+
+/**
+ * @brief FAT16's vectored write method, writes the buffers in order at the current offset
+ * The clusters for all buffers are reserved at once, then walked once
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param private void* - The file descriptor of the file to write
+ * @param iov const struct iovec* - The buffers to write
+ * @param iovcnt int - The number of buffers
+ * @return int - The number of bytes written, otherwise return an error code
+ */
+int fat16_writev(struct disk* disk, void* private, const struct iovec* iov, int iovcnt)
+{
+    struct fat16_file_descriptor* descriptor = (struct fat16_file_descriptor*)private;
+    struct fat16_entry* entry = descriptor->file->item->entry;
+    if(descriptor->mode == FILE_MODE_APPEND)
+    {
+        descriptor->offset = entry->size;
+    }
+
+    u32 total = 0;
+    for(int i = 0; i < iovcnt; i++)
+    {
+        total += iov[i].len;
+    }
+
+    u32 end = descriptor->offset + total;
+    int res = reserve_file_clusters(disk, descriptor, end);
+    if(res < 0)
+    {
+        return res;
+    }
+
+    res = transfer_internal_data(disk, get_first_cluster(entry), descriptor->offset, iov, total, true);
+    if(res < 0)
+    {
+        return res;
+    }
+
+    u32 pos = descriptor->offset;
+    for(int i = 0; i < iovcnt && !descriptor->file->unlinked; i++)
+    {
+        page_cache_update(disk, get_file_id(descriptor), pos, iov[i].base, iov[i].len);
+        pos += iov[i].len;
+    }
+
+    descriptor->offset = end;
+    if(end > entry->size)
+    {
+        entry->size = end;
+        descriptor->file->dirty = true;
+    }
+
+    return total;
+}
+
+/**
+ * @brief FAT16's truncate method, shrinks or grows a file to size bytes
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param private void* - The file descriptor of the file
+ * @param size u32 - The new size of the file
+ * @return int - 0 if success, otherwise return an error code
+ */
+int fat16_truncate(struct disk* disk, void* private, u32 size)
 {
-    struct fat16_file_descriptor* descriptor = (struct fat16_file_descriptor*)fd;
-    struct fat16_entry* entry = descriptor->item->entry;
-    int offset = descriptor->offset;
-    for(u32 i = 0; i < nb; i ++ )
+    struct fat16_file_descriptor* descriptor = (struct fat16_file_descriptor*)private;
+    struct fat16_entry* entry = descriptor->file->item->entry;
+    struct fat16_data* data = disk->data;
+    u32 cluster_size = data->header.header.sectors_per_cluster * disk->sector_size;
+    int res = 0;
+
+    if(size < entry->size)
     {
-        if(read_internal_data(disk, get_first_cluster(entry), offset, size, out) < 0)
+        res = release_file_clusters(disk, descriptor->file, (size + cluster_size - 1) / cluster_size);
+        page_cache_truncate(disk, get_file_id(descriptor), size);
+    } else if(size > entry->size) {
+        // The new part of the file must read as zeros
+        char zeros[SECTOR_SIZE];
+        memset(zeros, 0x00, sizeof(zeros));
+        res = reserve_file_clusters(disk, descriptor, size);
+        for(u32 pos = entry->size; res == 0 && pos < size; pos += sizeof(zeros))
         {
-            return 0;
+            u32 total = size - pos > sizeof(zeros) ? sizeof(zeros) : size - pos;
+            res = write_internal_data(disk, get_first_cluster(entry), pos, total, zeros);
+        }
+    }
+
+    if(res < 0)
+    {
+        return res;
+    }
+
+    entry->size = size;
+    descriptor->file->dirty = true;
+    return 0;
+}
+
+/**
+ * @brief FAT16's allocate method, reserves contiguous clusters for a file that will grow to size bytes
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param private void* - The file descriptor of the file
+ * @param size u32 - The size the file is expected to reach
+ * @return int - 0 if success, otherwise return an error code
+ */
+int fat16_allocate(struct disk* disk, void* private, u32 size)
+{
+    return reserve_file_clusters(disk, (struct fat16_file_descriptor*)private, size);
+}
+
+/**
+ * @brief FAT16's flush method, writes the directory entry and the FAT of a file back to the disk
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param private void* - The file descriptor of the file
+ * @return int - 0 if success, otherwise return an error code
+ */
+int fat16_flush(struct disk* disk, void* private)
+{
+    struct fat16_file_descriptor* descriptor = (struct fat16_file_descriptor*)private;
+    if(descriptor->file->dirty && !descriptor->file->unlinked)
+    {
+        if(write_directory_entry(disk, descriptor->file->item->entry_position, descriptor->file->item->entry) != 0)
+        {
+            return -EIO;
+        }
+        descriptor->file->dirty = false;
+    }
+
+    if(flush_fat(disk) != 0)
+    {
+        return -EIO;
+    }
+
+    return flush_disk_cache(disk);
+}
+
+/**
+ * @brief FAT16's unlink method, removes a file and frees its clusters
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param path struct path_part* - The path to the file
+ * @return int - 0 if success, otherwise return an error code
+ */
+int fat16_unlink(struct disk* disk, struct path_part* path)
+{
+    struct fat16_entry entry;
+    u64 position = 0;
+    if(find_path_entry(disk, path, 0, &entry, &position) != 0)
+    {
+        return -ENOENT;
+    }
+
+    if(entry.attr & FAT16_FILE_SUBDIRECTORY)
+    {
+        return -EINVARG;
+    }
+
+    int res = 0;
+    struct vnode* vnode = vnode_get(disk, position);
+    if(vnode)
+    {
+        // The descriptors still use the clusters, the last close frees them
+        ((struct fat16_file*)vnode->data)->unlinked = true;
+        vnode_unhash(vnode);
+        vnode_put(vnode);
+    } else if(get_first_cluster(&entry) != 0) {
+        res = free_cluster_chain(disk, get_first_cluster(&entry));
+        if(res < 0)
+        {
+            return res;
         }
+    }
+
+    page_cache_truncate(disk, position, 0);
+    entry.name[0] = FAT16_ENTRY_DELETED;
+    res = write_directory_entry(disk, position, &entry);
+    if(res < 0)
+    {
+        return res;
+    }
 
-        out += size;
-        offset += size;
+    res = flush_fat(disk);
+    if(res == 0)
+    {
+        res = flush_disk_cache(disk);
     }
 
-    return nb;
+    return res;
 }
 
 /**
  * @brief Free a fat16 file descriptor
  * @param desc struct fat16_file_descriptor* - The file descriptor to free
-
+ * @return int - 0 if success, otherwise the error of freeing the clusters on the last close
  */
-static void fat16_free_file_descriptor(struct fat16_file_descriptor* desc)
+static int fat16_free_file_descriptor(struct fat16_file_descriptor* desc)
 {
-    free_fat16_item(desc->item);
+    int res = put_file_vnode(desc->disk, desc->vnode); // The descriptor is gone even if the clusters could not be freed
     kfree(desc);
+    return res;
 }
 
 
@@ -776,7 +2273,7 @@ int fat16_stat(struct disk* disk, void* private, struct file_stat* stat)
 {
     int res = 0; 
     struct fat16_file_descriptor* descriptor = (struct fat16_file_descriptor*) private;
-    struct fat16_item* desc_item = descriptor->item;
+    struct fat16_item* desc_item = descriptor->file->item;
     if (desc_item->type != FAT16_ITEM_TYPE_FILE)
     {
         return -1;
@@ -797,10 +2294,217 @@ int fat16_stat(struct disk* disk, void* private, struct file_stat* stat)
 /**
  * @brief FAT16's close method for closing a file
  * @param private void* - The file descriptor of the file to close
- * @return int - 0 if the file is closed successfully
+ * @return int - 0 if success, otherwise the error of writing the file back, the descriptor is closed either way
  */
 int fat16_close(void* private)
 {
-    fat16_free_file_descriptor((struct fat16_file_descriptor*) private);
+    struct fat16_file_descriptor* descriptor = (struct fat16_file_descriptor*) private;
+    int res = 0;
+    if(descriptor->mode != FILE_MODE_READ)
+    {
+        res = fat16_flush(descriptor->disk, descriptor);
+    }
+
+    // The descriptor goes away even if the flush failed, otherwise the drive could never be unmounted
+    // Other descriptors may still write the clusters reserved by fat16_allocate(), the last close frees the unused ones
+    int put = fat16_free_file_descriptor(descriptor);
+    return res < 0 ? res : put;
+}
+
+/**
+ * @brief FAT16's unmount method, writes the FAT back and frees the state of the volume
+ * The VFS only unmounts a disk that has no open files or directories
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @return int - 0 if success, otherwise return an error code and the volume stays mounted
+ */
+int fat16_unmount(struct disk* disk)
+{
+    int res = flush_fat(disk);
+    if(res == 0)
+    {
+        res = flush_disk_cache(disk);
+    }
+
+    if(res < 0)
+    {
+        return res;
+    }
+
+    page_cache_drop_disk(disk);
+    free_fat16_data((struct fat16_data*)disk->data);
+    disk->data = 0;
+    disk->filesystem = 0;
+    return 0;
+}
+
+/**
+ * @brief FAT16's opendir method
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param path struct path_part* - The path to the directory, 0 for the root directory
+ * @return void* - The directory stream(fat16_dir_stream*), 0 if the directory can not be opened
+ */
+void* fat16_open_dir(struct disk* disk, struct path_part* path)
+{
+    int cluster = 0;
+    if(path)
+    {
+        struct fat16_entry entry;
+        u64 position = 0;
+        if(find_path_entry(disk, path, 0, &entry, &position) != 0 || !(entry.attr & FAT16_FILE_SUBDIRECTORY))
+        {
+            return 0;
+        }
+        cluster = get_first_cluster(&entry);
+    }
+
+    struct fat16_dir_stream* stream = (struct fat16_dir_stream*)kmalloc(sizeof(struct fat16_dir_stream));
+    if(!stream)
+    {
+        return 0;
+    }
+
+    if(open_dir_stream(disk, cluster, stream) != 0)
+    {
+        kfree(stream);
+        return 0;
+    }
+
+    return stream;
+}
+
+/**
+ * @brief FAT16's readdir method
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param private void* - The directory stream
+ * @param[out] dirent struct dirent* - The next entry
+ * @return int - 1 if an entry is returned, 0 at the end of the directory, otherwise return an error code
+ */
+int fat16_read_dir(struct disk* disk, void* private, struct dirent* dirent)
+{
+    struct fat16_entry* entry = 0;
+    u64 position = 0;
+    int res = read_dir_stream((struct fat16_dir_stream*)private, &entry, &position);
+    if(res <= 0)
+    {
+        return res;
+    }
+
+    get_full_filename(entry, dirent->name, sizeof(dirent->name));
+    dirent->size = entry->size;
+    dirent->flags = 0x00;
+    if(entry->attr & FAT16_FILE_READ_ONLY)
+    {
+        dirent->flags |= FILE_STAT_READ_ONLY;
+    }
+    if(entry->attr & FAT16_FILE_SUBDIRECTORY)
+    {
+        dirent->flags |= FILE_STAT_DIRECTORY;
+    }
+
+    return 1;
+}
+
+int fat16_close_dir(void* private)
+{
+    close_dir_stream((struct fat16_dir_stream*)private);
+    kfree(private);
+    return 0;
+}
+
+/**
+ * @brief FAT16's map method, gets a page of a file from the page cache and holds it for a mapping
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param private void* - The file descriptor of the file
+ * @param index u32 - The page index within the file
+ * @param[out] page void** - The page aligned data of the page
+ * @return int - 0 if success, otherwise return an error code
+ */
+int fat16_map_page(struct disk* disk, void* private, u32 index, void** page)
+{
+    struct fat16_file_descriptor* descriptor = (struct fat16_file_descriptor*)private;
+    if(index * PAGE_SIZE >= descriptor->file->item->entry->size || descriptor->file->unlinked)
+    {
+        return -EINVARG;
+    }
+
+    struct page_cache_page* cached = 0;
+    int res = fill_file_pages(disk, descriptor, index, index, &cached);
+    if(res < 0)
+    {
+        return res;
+    }
+
+    *page = cached->data; // The hold of fill_file_pages() is the hold of the mapping
     return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief FAT16's copy method, copies between two files of the volume without going through the caller's buffers
+ * The destination is reserved in one allocation and the data moves in whole clusters, the source is read around the page cache
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param in void* - The file descriptor to copy from, from its current offset
+ * @param out void* - The file descriptor to copy to, at its current offset
+ * @param len u32 - The bytes to copy, fewer are copied at the end of the source
+ * @return int - The number of bytes copied, otherwise return an error code
+ */
+int fat16_copy_range(struct disk* disk, void* in, void* out, u32 len)
+{
+    struct fat16_file_descriptor* source = (struct fat16_file_descriptor*)in;
+    struct fat16_file_descriptor* dest = (struct fat16_file_descriptor*)out;
+    struct fat16_entry* entry = source->file->item->entry;
+    struct fat16_data* data = disk->data;
+    u32 cluster_size = data->header.header.sectors_per_cluster * disk->sector_size;
+
+    u32 left = entry->size > source->offset ? entry->size - source->offset : 0;
+    if(len > left)
+    {
+        len = left;
+    }
+
+    if(len == 0)
+    {
+        return 0;
+    }
+
+    u32 size = COPY_FILE_BUFFER_SIZE / cluster_size * cluster_size;
+    if(size == 0)
+    {
+        size = cluster_size;
+    }
+    if(size > len)
+    {
+        size = len;
+    }
+
+    char* buffer = (char*)kmalloc(size);
+    if(!buffer)
+    {
+        return -ENOMEM;
+    }
+
+    u32 dest_offset = dest->mode == FILE_MODE_APPEND ? dest->file->item->entry->size : dest->offset;
+    int res = reserve_file_clusters(disk, dest, dest_offset + len);
+    u32 done = 0;
+    while(res == 0 && done < len)
+    {
+        struct iovec iov = { .base = buffer, .len = len - done > size ? size : len - done };
+        res = transfer_internal_data(disk, get_first_cluster(entry), source->offset, &iov, iov.len, false);
+        if(res < 0)
+        {
+            break;
+        }
+
+        res = fat16_writev(disk, dest, &iov, 1);
+        if(res < 0)
+        {
+            break;
+        }
+
+        source->offset += iov.len;
+        done += iov.len;
+        res = 0;
+    }
+
+    kfree(buffer);
+    return done ? (int)done : res;
+}
@@ -0,0 +1,163 @@
+#include "fat32.h"
+#include "fat16.h"
+#include "string.h"
+#include "errno.h"
+#include "types.h"
+#include "disk.h"
+#include "config.h"
+
+#define FAT32_FS_INFO_LEAD_SIGNATURE 0x41615252
+#define FAT32_FS_INFO_STRUCT_SIGNATURE 0x61417272
+#define FAT32_FS_INFO_TRAIL_SIGNATURE 0xAA550000
+#define FAT32_FS_INFO_UNKNOWN 0xFFFFFFFF
+#define FAT32_NO_FS_INFO 0xFFFF // fs_info_sector value of a volume without FSInfo
+
+#define u8 uint8_t
+#define u16 uint16_t
+#define u32 uint32_t
+
+// FAT32 boot sector, the common BIOS parameter block followed by the FAT32 extension
+struct fat32_header{
+    struct fat_header header;
+    u32 sectors_per_fat;
+    u16 ext_flags;
+    u16 version;
+    u32 root_cluster;
+    u16 fs_info_sector;
+    u16 backup_boot_sector;
+    u8 reserved[12];
+    u8 drive_number;
+    u8 reserved1;
+    u8 boot_signature;
+    u32 volume_id;
+    u8 volume_label[11];
+    u8 system_id[8];
+} __attribute__((packed));
+
+/**
+ * The FSInfo sector, hints about free space kept by whoever last wrote the volume
+ * @param free_clusters u32 - The number of free clusters, FAT32_FS_INFO_UNKNOWN if not known
+ * @param next_free u32 - The cluster allocation should start from, FAT32_FS_INFO_UNKNOWN if not known
+ */
+struct fat32_fs_info{
+    u32 lead_signature;
+    u8 reserved[480];
+    u32 struct_signature;
+    u32 free_clusters;
+    u32 next_free;
+    u8 reserved1[12];
+    u32 trail_signature;
+} __attribute__((packed));
+
+struct filesystem fat32_fs = {
+    .open_file = fat16_open_file,
+    .read_file = fat16_read_file,
+    .close = fat16_close,
+    .resolve = resolve_fat32,
+    .stat = fat16_stat,
+    .write_file = fat16_write_file,
+    .truncate = fat16_truncate,
+    .allocate = fat16_allocate,
+    .flush = fat16_flush,
+    .unlink = fat16_unlink,
+    .open_dir = fat16_open_dir,
+    .read_dir = fat16_read_dir,
+    .close_dir = fat16_close_dir,
+    .readv = fat16_readv,
+    .writev = fat16_writev,
+    .map_page = fat16_map_page,
+    .unmount = fat16_unmount,
+    .copy_range = fat16_copy_range
+};
+
+struct filesystem* init_fat32()
+{
+    strcpy(fat32_fs.name, "FAT32");
+    return &fat32_fs;
+}
+
+static bool is_valid_fs_info(struct fat32_fs_info* info)
+{
+    return info->lead_signature == FAT32_FS_INFO_LEAD_SIGNATURE
+        && info->struct_signature == FAT32_FS_INFO_STRUCT_SIGNATURE
+        && info->trail_signature == FAT32_FS_INFO_TRAIL_SIGNATURE;
+}
+
+/**
+ * @brief Record the free cluster count and the next free cluster in the FSInfo sector
+ * @param disk struct disk* - The disk that the filesystem is on
+ * @param info_sector u32 - The FSInfo sector
+ * @param free_clusters u32 - The number of free clusters
+ * @param next_free u32 - The cluster allocation should start from
+ * @return int - 0 if success, otherwise return an error code
+ */
+static int fat32_sync_fs_info(struct disk* disk, u32 info_sector, u32 free_clusters, u32 next_free)
+{
+    struct fat32_fs_info info;
+    if(read_disk_block(disk, info_sector, 1, &info) != 0)
+    {
+        return -EIO;
+    }
+
+    if(!is_valid_fs_info(&info))
+    {
+        return 0;
+    }
+
+    info.free_clusters = free_clusters;
+    info.next_free = next_free;
+    return write_disk_block(disk, info_sector, 1, &info) != 0 ? -EIO : 0;
+}
+
+/**
+ * Resolve the fat32 filesystem
+ * The FSInfo free count and next free hints are passed on to the shared FAT code
+ * @param[in] disk struct disk* - The disk that the filesystem is on
+ * @return int - 0 if the filesystem is resolved successfully, otherwise return an error code
+ */
+int resolve_fat32(struct disk* disk)
+{
+    char buf[SECTOR_SIZE];
+    if(disk->sector_size != SECTOR_SIZE || read_disk_block(disk, 0, 1, buf) != 0)
+    {
+        return -EIO;
+    }
+
+    struct fat32_header* header = (struct fat32_header*)buf;
+    if(header->boot_signature != 0x28 && header->boot_signature != 0x29)
+    {
+        return -EINVARG;
+    }
+
+    // A FAT32 volume has no fixed root directory and keeps its FAT size in the extension
+    if(header->header.sectors_per_fat != 0 || header->header.root_entry_count != 0
+        || header->sectors_per_fat == 0 || header->root_cluster < 2
+        || header->header.bytes_per_sector != disk->sector_size)
+    {
+        return -EINVARG;
+    }
+
+    struct fat_volume volume;
+    memset(&volume, 0x00, sizeof(volume));
+    volume.type = FAT_TYPE_32;
+    volume.header = header->header;
+    volume.fat_sectors = header->sectors_per_fat;
+    volume.root_cluster = header->root_cluster;
+    volume.free_clusters = FAT32_FS_INFO_UNKNOWN;
+
+    u32 info_sector = header->fs_info_sector;
+    struct fat32_fs_info* info = (struct fat32_fs_info*)buf;
+    if(info_sector != 0 && info_sector != FAT32_NO_FS_INFO
+        && read_disk_block(disk, info_sector, 1, buf) == 0 && is_valid_fs_info(info))
+    {
+        volume.info_sector = info_sector;
+        volume.sync_info = fat32_sync_fs_info;
+        volume.free_clusters = info->free_clusters;
+        if(info->next_free != FAT32_FS_INFO_UNKNOWN)
+        {
+            volume.next_free = info->next_free;
+        }
+    }
+
+    return fat_mount(disk, &fat32_fs, &volume);
+}
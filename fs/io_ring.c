@@ -0,0 +1,280 @@
+#include "io_ring.h"
+#include "vfs.h"
+#include "disk.h"
+#include "mm.h"
+#include "string.h"
+#include "errno.h"
+#include "thread.h"
+#include "atomic.h"
+#include "io.h"
+
+// Rings with published submissions, serviced in order by the worker thread
+static struct spinlock pending_lock;
+static struct io_ring* pending_head;
+static struct io_ring* pending_tail;
+static struct wait_queue worker_wait; // The worker sleeps here while no ring is pending
+static bool worker_running; // Without the worker, io_ring_submit() services the batch itself
+
+/**
+ * @brief Set up the rings of an io_ring
+ * @param ring The ring to set up
+ * @param entries The number of entries of each ring, rounded up to a power of two
+ * @return 0 if success, otherwise a negative error code
+ */
+int io_ring_init(struct io_ring* ring, uint32_t entries)
+{
+    memset(ring, 0x00, sizeof(struct io_ring));
+    if(entries == 0)
+    {
+        return -EINVARG;
+    }
+
+    uint32_t size = 1;
+    while(size < entries)
+    {
+        size <<= 1;
+    }
+
+    ring->sqes = (struct io_sqe*)kmalloc(size * sizeof(struct io_sqe));
+    ring->cqes = (struct io_cqe*)kmalloc(size * sizeof(struct io_cqe));
+    if(!ring->sqes || !ring->cqes)
+    {
+        io_ring_free(ring);
+        return -ENOMEM;
+    }
+
+    ring->entries = size;
+    ring->mask = size - 1;
+    wait_queue_init(&ring->cq_wait);
+    return 0;
+}
+
+/**
+ * @brief Free the rings, waiting until the worker is done with them
+ * Submissions still queued behind a full completion ring are dropped
+ */
+void io_ring_free(struct io_ring* ring)
+{
+    wait_event(&ring->cq_wait, !ring->queued);
+    if(ring->sqes) kfree(ring->sqes);
+    if(ring->cqes) kfree(ring->cqes);
+    memset(ring, 0x00, sizeof(struct io_ring));
+}
+
+/**
+ * @brief Get the next free submission entry, it is queued by io_ring_submit()
+ * @return The entry to fill in, 0 if the submission ring is full
+ */
+struct io_sqe* io_ring_get_sqe(struct io_ring* ring)
+{
+    if(ring->sqe_tail - ring->sq_head == ring->entries)
+    {
+        return 0;
+    }
+
+    struct io_sqe* sqe = &ring->sqes[ring->sqe_tail & ring->mask];
+    memset(sqe, 0x00, sizeof(struct io_sqe));
+    ring->sqe_tail ++;
+    return sqe;
+}
+
+static int io_ring_block(struct io_sqe* sqe, bool write)
+{
+    struct disk* disk = get_disk(sqe->fd);
+    if(!disk)
+    {
+        return -EIO;
+    }
+
+    int res = write ? write_disk_block(disk, sqe->offset, sqe->len, sqe->buf) : read_disk_block(disk, sqe->offset, sqe->len, sqe->buf);
+    return res != 0 ? -EIO : sqe->len * disk->sector_size;
+}
+
+static int io_ring_execute(struct io_sqe* sqe)
+{
+    struct iovec iov = { .base = sqe->buf, .len = sqe->len };
+    switch(sqe->opcode)
+    {
+        case IO_RING_OP_NOP:
+            return 0;
+        case IO_RING_OP_READ:
+            return freadv(sqe->fd, &iov, 1);
+        case IO_RING_OP_WRITE:
+            return fwritev(sqe->fd, &iov, 1);
+        case IO_RING_OP_READV:
+            return freadv(sqe->fd, (const struct iovec*)sqe->buf, sqe->len);
+        case IO_RING_OP_WRITEV:
+            return fwritev(sqe->fd, (const struct iovec*)sqe->buf, sqe->len);
+        case IO_RING_OP_FSYNC:
+            return fsync(sqe->fd);
+        case IO_RING_OP_READ_BLOCK:
+            return io_ring_block(sqe, false);
+        case IO_RING_OP_WRITE_BLOCK:
+            return io_ring_block(sqe, true);
+    }
+
+    return -EINVARG;
+}
+
+/**
+ * @brief Service the published submissions in order and post their completions, waking the waiting caller
+ * A submission is left queued while the completion ring is full
+ * @return The number of submissions serviced
+ */
+static int io_ring_service(struct io_ring* ring)
+{
+    int done = 0;
+    while(ring->sq_head != ring->sq_tail && ring->cq_tail - ring->cq_head < ring->entries)
+    {
+        struct io_sqe* sqe = &ring->sqes[ring->sq_head & ring->mask];
+        struct io_cqe* cqe = &ring->cqes[ring->cq_tail & ring->mask];
+        cqe->user_data = sqe->user_data;
+        cqe->res = io_ring_execute(sqe);
+        asm volatile("" : : : "memory"); // The completion is written before the caller can see it
+        ring->sq_head ++;
+        ring->cq_tail ++;
+        done ++;
+        wake_up(&ring->cq_wait);
+    }
+
+    return done;
+}
+
+// Append a ring to the list of the worker unless it is there already
+static void queue_ring(struct io_ring* ring)
+{
+    uint32_t flags = irq_save();
+    spin_lock(&pending_lock);
+    if(!ring->queued)
+    {
+        ring->queued = true;
+        ring->next = 0;
+        if(pending_tail)
+        {
+            pending_tail->next = ring;
+        }
+        else
+        {
+            pending_head = ring;
+        }
+        pending_tail = ring;
+    }
+    spin_unlock(&pending_lock);
+    irq_restore(flags);
+}
+
+static struct io_ring* take_pending_ring()
+{
+    uint32_t flags = irq_save();
+    spin_lock(&pending_lock);
+    struct io_ring* ring = pending_head;
+    if(ring)
+    {
+        pending_head = ring->next;
+        if(!pending_head)
+        {
+            pending_tail = 0;
+        }
+    }
+    spin_unlock(&pending_lock);
+    irq_restore(flags);
+    return ring;
+}
+
+/**
+ * @brief Worker thread: sleep until a ring is submitted, then service it
+ * The disk requests sleep until IRQ 14 completes them, so other threads run while a batch is in flight
+ */
+static void io_ring_worker(void* arg)
+{
+    for(;;)
+    {
+        struct io_ring* ring;
+        wait_event(&worker_wait, (ring = take_pending_ring()) != 0);
+        io_ring_service(ring);
+
+        // A racing io_ring_submit() either finds the ring still queued or its sq_tail is seen here, both under pending_lock
+        // io_ring_free() checks queued under the queue lock, so releasing that lock is the last access to the ring
+        uint32_t flags = wait_queue_lock(&ring->cq_wait);
+        spin_lock(&pending_lock);
+        ring->queued = false;
+        bool more = ring->sq_head != ring->sq_tail && ring->cq_tail - ring->cq_head < ring->entries;
+        spin_unlock(&pending_lock);
+        if(more)
+        {
+            queue_ring(ring);
+        }
+        wake_up_locked(&ring->cq_wait);
+        wait_queue_unlock(&ring->cq_wait, flags);
+    }
+}
+
+/**
+ * @brief Start the worker thread that services the rings, call after thread_init()
+ */
+void init_io_rings()
+{
+    pending_lock.locked = 0;
+    pending_head = 0;
+    pending_tail = 0;
+    wait_queue_init(&worker_wait);
+    worker_running = thread_create(io_ring_worker, 0, "io_ring") >= 0;
+}
+
+/**
+ * @brief Hand the submissions filled in since the last call to the worker thread, without waiting for them
+ * Their completions are posted as the requests finish, io_ring_wait_cqe() sleeps until the next one
+ * Before init_io_rings() there is no worker, the batch is serviced here and is complete on return
+ * A submission stays queued while the completion ring is full, the next call hands it over again
+ * @return The number of submissions handed over(or serviced)
+ */
+int io_ring_submit(struct io_ring* ring)
+{
+    int total = ring->sqe_tail - ring->sq_tail;
+    asm volatile("" : : : "memory"); // The entries are filled in before the worker can see them
+    ring->sq_tail = ring->sqe_tail;
+    if(!worker_running)
+    {
+        return io_ring_service(ring);
+    }
+
+    if(ring->sq_head != ring->sq_tail)
+    {
+        queue_ring(ring);
+        wake_up(&worker_wait);
+    }
+    return total;
+}
+
+/**
+ * @brief Get the oldest completion without consuming it
+ * @return The completion, 0 if the completion ring is empty
+ */
+struct io_cqe* io_ring_peek_cqe(struct io_ring* ring)
+{
+    if(ring->cq_head == ring->cq_tail)
+    {
+        return 0;
+    }
+
+    return &ring->cqes[ring->cq_head & ring->mask];
+}
+
+/**
+ * @brief Sleep until a completion is posted and return the oldest one without consuming it
+ * @return The completion, 0 if nothing is submitted that could complete
+ */
+struct io_cqe* io_ring_wait_cqe(struct io_ring* ring)
+{
+    wait_event(&ring->cq_wait, ring->cq_head != ring->cq_tail || (ring->sq_head == ring->sq_tail && !ring->queued));
+    return io_ring_peek_cqe(ring);
+}
+
+// Give the completion returned by io_ring_peek_cqe() back to the ring
+void io_ring_cqe_seen(struct io_ring* ring)
+{
+    if(ring->cq_head != ring->cq_tail)
+    {
+        ring->cq_head ++;
+    }
+}
@@ -0,0 +1,331 @@
+#include "page_cache.h"
+#include "page.h"
+#include "config.h"
+#include "mm.h"
+#include "string.h"
+#include "errno.h"
+#include "thread.h"
+
+/**
+ * Page cache for file data, shared by every filesystem
+ * Pages are looked up by (disk, file id, page index) in a hash table and evicted least recently used first;
+ * all page buffers come from one page aligned pool so a mapped address leads back to its page in O(1)
+ * The mounts share the pages, each calls in under its own lock, so page_cache_lock guards the tables
+ */
+static struct page_cache_page pages[PAGE_CACHE_PAGES];
+static struct page_cache_page* buckets[PAGE_CACHE_BUCKETS];
+static char* pool;
+
+// Least recently used page at the tail, every page not held is on the list
+static struct page_cache_page* lru_head;
+static struct page_cache_page* lru_tail;
+
+static struct mutex page_cache_lock;
+
+static uint32_t page_cache_hash(struct disk* disk, uint64_t file_id, uint32_t index)
+{
+    return ((uint32_t)disk ^ ((uint32_t)file_id * 31) ^ (uint32_t)(file_id >> 32) ^ (index * 2654435761u)) % PAGE_CACHE_BUCKETS;
+}
+
+static void lru_remove(struct page_cache_page* page)
+{
+    if(page->lru_prev) page->lru_prev->lru_next = page->lru_next; else lru_head = page->lru_next;
+    if(page->lru_next) page->lru_next->lru_prev = page->lru_prev; else lru_tail = page->lru_prev;
+    page->lru_prev = page->lru_next = 0;
+}
+
+static void lru_push_front(struct page_cache_page* page)
+{
+    page->lru_prev = 0;
+    page->lru_next = lru_head;
+    if(lru_head) lru_head->lru_prev = page; else lru_tail = page;
+    lru_head = page;
+}
+
+static void hash_remove(struct page_cache_page* page)
+{
+    struct page_cache_page** link = &buckets[page_cache_hash(page->disk, page->file_id, page->index)];
+    while(*link && *link != page)
+    {
+        link = &(*link)->hash_next;
+    }
+
+    if(*link)
+    {
+        *link = page->hash_next;
+    }
+    page->hash_next = 0;
+}
+
+/**
+ * @brief Allocate the page pool, every page starts free on the LRU list
+ * @return 0 if success, otherwise a negative error code
+ */
+int page_cache_init()
+{
+    mutex_init(&page_cache_lock);
+    memset(pages, 0x00, sizeof(pages));
+    memset(buckets, 0x00, sizeof(buckets));
+    lru_head = lru_tail = 0;
+
+    pool = (char*)kmalloc(PAGE_CACHE_PAGES * PAGE_SIZE);
+    if(!pool)
+    {
+        return -ENOMEM;
+    }
+
+    for(int i = 0; i < PAGE_CACHE_PAGES; i++)
+    {
+        pages[i].data = pool + i * PAGE_SIZE;
+        lru_push_front(&pages[i]);
+    }
+
+    return 0;
+}
+
+// Find a cached page and mark it most recently used
+static struct page_cache_page* find_page(struct disk* disk, uint64_t file_id, uint32_t index)
+{
+    struct page_cache_page* page = buckets[page_cache_hash(disk, file_id, index)];
+    while(page && !(page->disk == disk && page->file_id == file_id && page->index == index))
+    {
+        page = page->hash_next;
+    }
+
+    if(page && page->refcount == 0)
+    {
+        lru_remove(page);
+        lru_push_front(page);
+    }
+
+    return page;
+}
+
+static void hold_page(struct page_cache_page* page)
+{
+    if(page->refcount++ == 0)
+    {
+        lru_remove(page);
+    }
+}
+
+// Forget the contents of a page, it becomes the first to be reused
+static void drop_page(struct page_cache_page* page)
+{
+    if(page->used && page->file_id != PAGE_CACHE_NO_FILE)
+    {
+        hash_remove(page);
+    }
+
+    page->used = false;
+    if(page->refcount > 0)
+    {
+        page->file_id = PAGE_CACHE_NO_FILE; // Freed once released
+        return;
+    }
+
+    lru_remove(page);
+    page->lru_prev = lru_tail;
+    if(lru_tail) lru_tail->lru_next = page; else lru_head = page;
+    lru_tail = page;
+}
+
+/**
+ * @brief Find a cached page and mark it most recently used
+ * The page may be evicted once the caller's lock is released, page_cache_get() holds it
+ * @return The page, 0 if it is not cached
+ */
+struct page_cache_page* page_cache_lookup(struct disk* disk, uint64_t file_id, uint32_t index)
+{
+    mutex_lock(&page_cache_lock);
+    struct page_cache_page* page = find_page(disk, file_id, index);
+    mutex_unlock(&page_cache_lock);
+    return page;
+}
+
+/**
+ * @brief Find a cached page and hold it
+ * @return The held page, 0 if it is not cached
+ */
+struct page_cache_page* page_cache_get(struct disk* disk, uint64_t file_id, uint32_t index)
+{
+    mutex_lock(&page_cache_lock);
+    struct page_cache_page* page = find_page(disk, file_id, index);
+    if(page)
+    {
+        hold_page(page);
+    }
+    mutex_unlock(&page_cache_lock);
+    return page;
+}
+
+/**
+ * @brief Take the least recently used page for a new file page, its data is zeroed
+ * The page is returned held, the caller fills the data, or gives the page back with page_cache_drop() if that fails
+ * @return The page, 0 if every page is held
+ */
+struct page_cache_page* page_cache_alloc(struct disk* disk, uint64_t file_id, uint32_t index)
+{
+    mutex_lock(&page_cache_lock);
+    struct page_cache_page* page = lru_tail;
+    if(!page || !pool)
+    {
+        mutex_unlock(&page_cache_lock);
+        return 0;
+    }
+
+    if(page->used)
+    {
+        hash_remove(page);
+    }
+
+    page->disk = disk;
+    page->file_id = file_id;
+    page->index = index;
+    page->used = true;
+    memset(page->data, 0x00, PAGE_SIZE);
+
+    uint32_t bucket = page_cache_hash(disk, file_id, index);
+    page->hash_next = buckets[bucket];
+    buckets[bucket] = page;
+
+    lru_remove(page);
+    page->refcount = 1;
+    mutex_unlock(&page_cache_lock);
+    return page;
+}
+
+// Forget the contents of a page, a held page is detached from its file and freed once released
+void page_cache_drop(struct page_cache_page* page)
+{
+    mutex_lock(&page_cache_lock);
+    drop_page(page);
+    mutex_unlock(&page_cache_lock);
+}
+
+// Keep a page in memory(e.g. while it is mapped), it leaves the LRU list
+void page_cache_hold(struct page_cache_page* page)
+{
+    mutex_lock(&page_cache_lock);
+    hold_page(page);
+    mutex_unlock(&page_cache_lock);
+}
+
+void page_cache_release(struct page_cache_page* page)
+{
+    mutex_lock(&page_cache_lock);
+    if(page->refcount <= 0 || --page->refcount > 0)
+    {
+        mutex_unlock(&page_cache_lock);
+        return;
+    }
+
+    if(page->file_id == PAGE_CACHE_NO_FILE) // The file went away while the page was held
+    {
+        page->used = false;
+        page->lru_prev = lru_tail;
+        page->lru_next = 0;
+        if(lru_tail) lru_tail->lru_next = page; else lru_head = page;
+        lru_tail = page;
+        mutex_unlock(&page_cache_lock);
+        return;
+    }
+
+    lru_push_front(page);
+    mutex_unlock(&page_cache_lock);
+}
+
+/**
+ * @brief Get the page owning a page buffer address
+ * @return The page, 0 if the address is not in the page pool
+ */
+struct page_cache_page* page_cache_from_address(void* data)
+{
+    if(!pool || (char*)data < pool || (char*)data >= pool + PAGE_CACHE_PAGES * PAGE_SIZE)
+    {
+        return 0;
+    }
+
+    return &pages[((char*)data - pool) / PAGE_SIZE];
+}
+
+/**
+ * @brief Copy data just written to a file into the pages of it that are cached
+ * @param offset uint32_t - The file offset the data was written at
+ */
+void page_cache_update(struct disk* disk, uint64_t file_id, uint32_t offset, const void* buf, uint32_t len)
+{
+    const char* in = (const char*)buf;
+    mutex_lock(&page_cache_lock);
+    while(len > 0)
+    {
+        uint32_t page_offset = offset % PAGE_SIZE;
+        uint32_t total = PAGE_SIZE - page_offset;
+        if(total > len)
+        {
+            total = len;
+        }
+
+        struct page_cache_page* page = find_page(disk, file_id, offset / PAGE_SIZE);
+        if(page)
+        {
+            memcpy((char*)page->data + page_offset, (void*)in, total);
+        }
+
+        in += total;
+        offset += total;
+        len -= total;
+    }
+    mutex_unlock(&page_cache_lock);
+}
+
+/**
+ * @brief Drop the cached pages of a file past size bytes and zero the tail of its last page
+ * Pages that are still held are detached from the file and freed once released
+ * @param size uint32_t - The new size of the file, 0 when the file is removed
+ */
+void page_cache_truncate(struct disk* disk, uint64_t file_id, uint32_t size)
+{
+    mutex_lock(&page_cache_lock);
+    for(int i = 0; i < PAGE_CACHE_PAGES; i++)
+    {
+        struct page_cache_page* page = &pages[i];
+        if(!page->used || page->disk != disk || page->file_id != file_id)
+        {
+            continue;
+        }
+
+        uint32_t start = page->index * PAGE_SIZE;
+        if(start < size)
+        {
+            if(size - start < PAGE_SIZE)
+            {
+                memset((char*)page->data + (size - start), 0x00, PAGE_SIZE - (size - start));
+            }
+            continue;
+        }
+
+        drop_page(page);
+    }
+    mutex_unlock(&page_cache_lock);
+}
+
+/**
+ * @brief Forget the pages of every file of a disk, e.g. when it is unmounted
+ * Mapped pages stay valid for their mappings but no longer belong to a file
+ */
+void page_cache_drop_disk(struct disk* disk)
+{
+    mutex_lock(&page_cache_lock);
+    for(int i = 0; i < PAGE_CACHE_PAGES; i++)
+    {
+        struct page_cache_page* page = &pages[i];
+        if(!page->used || page->disk != disk)
+        {
+            continue;
+        }
+
+        drop_page(page);
+    }
+    mutex_unlock(&page_cache_lock);
+}
@@ -1,6 +1,5 @@
 #include "path.h"
 #include "string.h"
-#include "mm.h"
 #include "config.h"
 #include "errno.h"
 
@@ -30,128 +29,77 @@ static int get_path_drive(const char** path)
 }
 
 /**
- * @name create_root
- * @param drv_no The drive number (Typically Get from get_path_drive(original_path))
- * @brief Create a new path_root struct(without exception handling)
- * @return A new path_root struct(allocated by kmalloc in heap without exception handling) with the drive number and the first_part set to 0(null)
+ * @name parse_path_part
+ * @param path The path skipping "0:/", path will be updated to the next part after returning(e.g. "part/sub/sub2" -> "sub/sub2")
+ * @param part The span to fill in, it points into the path
+ * @brief Cut the next component off the path, repeated slashes are skipped
+ * @return The length of the component, 0 if the path has no more components
 */
-static struct path_root* create_root(int drv_no)
+static int parse_path_part(const char** path, struct path_part* part)
 {
-    struct path_root *root = kmalloc(sizeof(struct path_root));
-    root->drive_no = drv_no;
-    root->first_part = 0;
-
-    return root;
-}
-
-/**
- * @name create_path_part
- * @param part The path skipping "0:/", typically get from get_path_drive(original_path); part will be updated to the next part after returning(e.g. "part/sub/sub2" -> "sub/sub2")
- * @brief Create a new path_part struct(without exception handling)
- * @return A new path_part struct(allocated by kmalloc in heap without exception handling) with the part set to the path part and the next set to 0(null)
-*/
-static const char* create_path_part(const char** part)
-{
-    char* path_part = kmalloc(MAX_PATH_LEN);
-    int cnt = 0;
-    while(**part != '/' && **part != '\0')
-    {
-        path_part[cnt] = **part;
-        cnt ++;
-        (*part)++;
-    }
-
-    if(**part == '/')
+    while(**path == '/')
     {
-        // Skip the slash
-        // In case next time we call this function, we don't want to copy the slash
-        (*part)++;
+        (*path)++;
     }
 
-    if(cnt == 0)
-    {
-        kfree(path_part);
-        path_part = 0;
-        return 0;
-    }
-
-    return path_part;
-}
-
-/**
- * @name parse_path
- * @param last_part The last struct path_part(Typically get from create_path_part), its next will point to the part returned by this function; if it's the first part after root, set it to 0(null)
- * @param path The path typically get from create_path_part or get_path_drive; path will be updated to the next part after returning(e.g. "part/sub/sub2" -> "sub/sub2")
- * @return A new path_part struct(allocated by kmalloc in heap without exception handling) with the part set to the path part and the next set to 0(null)
-*/
-struct path_part* parse_path(struct path_part* last_part, const char** path)
-{
-    const char* part_str = create_path_part(path);
-    if(!part_str)
-    {
-        return 0;
-    }
-
-    struct path_part* part = kmalloc(sizeof(struct path_part));
-    part->part = part_str;
+    part->part = *path;
+    part->len = 0;
     part->next = 0;
-
-    if(last_part){ // if last_part is not null
-        last_part->next = part;
+    while(**path != '/' && **path != '\0')
+    {
+        part->len ++;
+        (*path)++;
     }
 
-    return part;
+    return part->len;
 }
 
 /**
- * @name free_path
- * @param root The root struct path_root for the whole path to be freed
- * @brief free the whole path
+ * @name parse
+ * @param path The path to parse, e.g. "0:/dir/file.txt"
+ * @param root The path_root to fill in, usually on the caller's stack
+ * @brief Split a path into spans over the original string, no memory is allocated
+ * @return 0 if success, -EINVAPTH if the path is malformed, too long or has more than MAX_PATH_PARTS components
 */
-void free_path(struct path_root* root){
-    struct path_part* part = root->first_part;
-    while(part)
-    {
-        struct path_part* next = part->next;
-        kfree((void*)part->part);
-        kfree((void*)part);
-        part = next;
-    }
-
-    kfree((void*)root);
-}
-
-struct path_root* parse(const char* path)
+int parse(const char* path, struct path_root* root)
 {
-    int drive_no = 0;
     const char* tmp = path;
-    struct path_root* root = 0;
-
     if(strlen(path) > MAX_PATH_LEN)
     {
-        return root;
+        return -EINVAPTH;
     }
 
-    drive_no = get_path_drive(&tmp);
-
-    root = create_root(drive_no);
-    if(!root)
+    root->drive_no = get_path_drive(&tmp);
+    if(root->drive_no < 0)
     {
-        return root;
+        return -EINVAPTH;
     }
 
-    struct path_part* first_part = parse_path(0, &tmp); // Get the first part
-    if(first_part) // if the first part is not null
+    root->first_part = 0;
+    root->total_parts = 0;
+    struct path_part* last_part = 0;
+    while(*tmp)
     {
-        root->first_part = first_part; // Set the first part
+        if(root->total_parts == MAX_PATH_PARTS)
+        {
+            return -EINVAPTH;
+        }
+
+        struct path_part* part = &root->parts[root->total_parts];
+        if(parse_path_part(&tmp, part) == 0) // Only trailing slashes were left
+        {
+            break;
+        }
+
+        if(last_part)
+        {
+            last_part->next = part;
+        } else {
+            root->first_part = part;
+        }
+        last_part = part;
+        root->total_parts ++;
     }
 
-    // root->first_part = first_part;
-    struct path_part* last_part = first_part;
-    while(last_part)
-    {
-        last_part = parse_path(last_part, &tmp);
-    }    
-
-    return root;
+    return 0;
 }
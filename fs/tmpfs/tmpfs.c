@@ -0,0 +1,748 @@
+#include "tmpfs.h"
+#include "string.h"
+#include "errno.h"
+#include "types.h"
+#include "disk.h"
+#include "mm.h"
+#include "config.h"
+#include "page.h"
+
+// Longest name, so it fits struct dirent with its terminator
+#define TMPFS_NAME_LEN 15
+
+// A directory doubles its buckets once it holds more than this many entries per bucket
+#define TMPFS_DIR_LOAD 2
+
+typedef char TMPFS_NODE_TYPE;
+#define TMPFS_NODE_TYPE_FILE 1
+#define TMPFS_NODE_TYPE_DIRECTORY 0
+
+/**
+ * A file or directory kept in memory
+ * @param name The name within the parent directory
+ * @param hash_next The next node in the same bucket of the parent directory
+ * @param refs Open files and directory streams on the node, an unlinked node is freed by the last close
+ * @param linked Whether the node is still in its parent directory
+ * @param size The file size in bytes
+ * @param chunks The file data, one page per slot, 0 for a hole that reads as zeros; bytes past size are always zero
+ * @param total_chunks The number of slots in chunks
+ * @param buckets The children of a directory, hashed by name
+ * @param total_buckets The number of buckets, a power of two
+ * @param entries The number of children
+ */
+struct tmpfs_node{
+    char name[TMPFS_NAME_LEN + 1];
+    TMPFS_NODE_TYPE type;
+    struct tmpfs_node* hash_next;
+    int refs;
+    bool linked;
+
+    uint32_t size;
+    void** chunks;
+    uint32_t total_chunks;
+
+    struct tmpfs_node** buckets;
+    uint32_t total_buckets;
+    uint32_t entries;
+};
+
+struct tmpfs_file_descriptor{
+    struct tmpfs_node* node;
+    uint32_t offset;
+};
+
+// Position of readdir, the n-th node of a bucket
+struct tmpfs_dir_stream{
+    struct tmpfs_node* dir;
+    uint32_t bucket;
+    uint32_t position;
+};
+
+static void* tmpfs_open_file(struct disk* disk, struct path_part* path, FILE_OPEN_MODE mode);
+static int tmpfs_read_file(struct disk* disk, void* private, uint32_t size, uint32_t nb, char* out);
+static int tmpfs_write_file(struct disk* disk, void* private, uint32_t size, uint32_t nb, const char* in);
+static int tmpfs_truncate(struct disk* disk, void* private, uint32_t size);
+static int tmpfs_allocate(struct disk* disk, void* private, uint32_t size);
+static int tmpfs_unlink(struct disk* disk, struct path_part* path);
+static int tmpfs_mkdir(struct disk* disk, struct path_part* path);
+static int tmpfs_stat(struct disk* disk, void* private, struct file_stat* stat);
+static int tmpfs_close(void* private);
+static void* tmpfs_open_dir(struct disk* disk, struct path_part* path);
+static int tmpfs_read_dir(struct disk* disk, void* private, struct dirent* dirent);
+static int tmpfs_close_dir(void* private);
+static int tmpfs_readv(struct disk* disk, void* private, const struct iovec* iov, int iovcnt);
+static int tmpfs_writev(struct disk* disk, void* private, const struct iovec* iov, int iovcnt);
+
+struct filesystem tmpfs_fs = {
+    .open_file = tmpfs_open_file,
+    .read_file = tmpfs_read_file,
+    .close = tmpfs_close,
+    .resolve = resolve_tmpfs,
+    .stat = tmpfs_stat,
+    .write_file = tmpfs_write_file,
+    .truncate = tmpfs_truncate,
+    .allocate = tmpfs_allocate,
+    .unlink = tmpfs_unlink,
+    .mkdir = tmpfs_mkdir,
+    .open_dir = tmpfs_open_dir,
+    .read_dir = tmpfs_read_dir,
+    .close_dir = tmpfs_close_dir,
+    .readv = tmpfs_readv,
+    .writev = tmpfs_writev
+};
+
+struct filesystem* init_tmpfs()
+{
+    strcpy(tmpfs_fs.name, "TMPFS");
+    return &tmpfs_fs;
+}
+
+// FNV-1a over a name span
+static uint32_t hash_name(const char* name, int len)
+{
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < len; i++)
+    {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static struct tmpfs_node** get_bucket(struct tmpfs_node* dir, const char* name, int len)
+{
+    return &dir->buckets[hash_name(name, len) & (dir->total_buckets - 1)];
+}
+
+static struct tmpfs_node* alloc_node(const char* name, int len, TMPFS_NODE_TYPE type)
+{
+    if(len > TMPFS_NAME_LEN)
+    {
+        return 0;
+    }
+
+    struct tmpfs_node* node = (struct tmpfs_node*)kmalloc(sizeof(struct tmpfs_node));
+    if(!node)
+    {
+        return 0;
+    }
+
+    memset(node, 0x00, sizeof(struct tmpfs_node));
+    memcpy(node->name, name, len);
+    node->type = type;
+    if(type == TMPFS_NODE_TYPE_DIRECTORY)
+    {
+        node->buckets = (struct tmpfs_node**)kmalloc(TMPFS_DIR_BUCKETS * sizeof(struct tmpfs_node*));
+        if(!node->buckets)
+        {
+            kfree(node);
+            return 0;
+        }
+
+        memset(node->buckets, 0x00, TMPFS_DIR_BUCKETS * sizeof(struct tmpfs_node*));
+        node->total_buckets = TMPFS_DIR_BUCKETS;
+    }
+
+    return node;
+}
+
+/**
+ * @brief Free a node and its data, a directory must be empty
+ */
+static void free_node(struct tmpfs_node* node)
+{
+    for(uint32_t i = 0; i < node->total_chunks; i++)
+    {
+        if(node->chunks[i])
+        {
+            kfree(node->chunks[i]);
+        }
+    }
+
+    if(node->chunks)
+    {
+        kfree(node->chunks);
+    }
+
+    if(node->buckets)
+    {
+        kfree(node->buckets);
+    }
+
+    kfree(node);
+}
+
+static struct tmpfs_node* find_child(struct tmpfs_node* dir, const char* name, int len)
+{
+    struct tmpfs_node* node = *get_bucket(dir, name, len);
+    while(node)
+    {
+        if(strlen(node->name) == len && strcmp_prefix(node->name, name, len) == 0)
+        {
+            return node;
+        }
+        node = node->hash_next;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Double the buckets of a directory and rehash its children
+ * @return int - 0 if success, -ENOMEM if the old buckets are kept
+ */
+static int grow_buckets(struct tmpfs_node* dir)
+{
+    uint32_t total = dir->total_buckets * 2;
+    struct tmpfs_node** buckets = (struct tmpfs_node**)kmalloc(total * sizeof(struct tmpfs_node*));
+    if(!buckets)
+    {
+        return -ENOMEM;
+    }
+
+    memset(buckets, 0x00, total * sizeof(struct tmpfs_node*));
+    for(uint32_t i = 0; i < dir->total_buckets; i++)
+    {
+        struct tmpfs_node* node = dir->buckets[i];
+        while(node)
+        {
+            struct tmpfs_node* next = node->hash_next;
+            struct tmpfs_node** bucket = &buckets[hash_name(node->name, strlen(node->name)) & (total - 1)];
+            node->hash_next = *bucket;
+            *bucket = node;
+            node = next;
+        }
+    }
+
+    kfree(dir->buckets);
+    dir->buckets = buckets;
+    dir->total_buckets = total;
+    return 0;
+}
+
+static void insert_child(struct tmpfs_node* dir, struct tmpfs_node* node)
+{
+    if(dir->entries >= dir->total_buckets * TMPFS_DIR_LOAD)
+    {
+        grow_buckets(dir); // Longer chains are still correct if this fails
+    }
+
+    struct tmpfs_node** bucket = get_bucket(dir, node->name, strlen(node->name));
+    node->hash_next = *bucket;
+    *bucket = node;
+    node->linked = true;
+    dir->entries ++;
+}
+
+static void remove_child(struct tmpfs_node* dir, struct tmpfs_node* node)
+{
+    struct tmpfs_node** link = get_bucket(dir, node->name, strlen(node->name));
+    while(*link && *link != node)
+    {
+        link = &(*link)->hash_next;
+    }
+
+    if(*link)
+    {
+        *link = node->hash_next;
+        dir->entries --;
+    }
+
+    node->hash_next = 0;
+    node->linked = false;
+}
+
+/**
+ * @brief Walk a path from the root directory
+ * @param stop struct path_part* - The part to stop at, 0 to walk the whole path
+ * @return struct tmpfs_node* - The node reached, 0 if a part does not exist or is not a directory
+ */
+static struct tmpfs_node* find_node(struct disk* disk, struct path_part* path, struct path_part* stop)
+{
+    struct tmpfs_node* node = (struct tmpfs_node*)disk->data;
+    while(path && path != stop)
+    {
+        if(node->type != TMPFS_NODE_TYPE_DIRECTORY)
+        {
+            return 0;
+        }
+
+        node = find_child(node, path->part, path->len);
+        if(!node)
+        {
+            return 0;
+        }
+        path = path->next;
+    }
+
+    return node;
+}
+
+static struct path_part* get_last_part(struct path_part* path)
+{
+    while(path->next)
+    {
+        path = path->next;
+    }
+
+    return path;
+}
+
+/**
+ * @brief Create a node in its parent directory
+ * @return struct tmpfs_node* - The new node, 0 if the parent does not exist, the name is taken or too long, or out of memory
+ */
+static struct tmpfs_node* create_node(struct disk* disk, struct path_part* path, TMPFS_NODE_TYPE type)
+{
+    struct path_part* last = get_last_part(path);
+    struct tmpfs_node* parent = find_node(disk, path, last);
+    if(!parent || parent->type != TMPFS_NODE_TYPE_DIRECTORY || find_child(parent, last->part, last->len))
+    {
+        return 0;
+    }
+
+    struct tmpfs_node* node = alloc_node(last->part, last->len, type);
+    if(!node)
+    {
+        return 0;
+    }
+
+    insert_child(parent, node);
+    return node;
+}
+
+/**
+ * @brief Make sure a file has chunk slots for its first total chunks
+ * @return int - 0 if success, otherwise -ENOMEM
+ */
+static int reserve_chunk_slots(struct tmpfs_node* node, uint32_t total)
+{
+    if(total <= node->total_chunks)
+    {
+        return 0;
+    }
+
+    uint32_t slots = node->total_chunks ? node->total_chunks * 2 : 4;
+    if(slots < total)
+    {
+        slots = total;
+    }
+
+    void** chunks = (void**)kmalloc(slots * sizeof(void*));
+    if(!chunks)
+    {
+        return -ENOMEM;
+    }
+
+    memset(chunks, 0x00, slots * sizeof(void*));
+    if(node->chunks)
+    {
+        memcpy(chunks, node->chunks, node->total_chunks * sizeof(void*));
+        kfree(node->chunks);
+    }
+
+    node->chunks = chunks;
+    node->total_chunks = slots;
+    return 0;
+}
+
+/**
+ * @brief Get a chunk of a file
+ * @param create bool - Allocate a zeroed chunk for a hole, its slot must be reserved
+ * @return char* - The chunk, 0 for a hole or if out of memory
+ */
+static char* get_chunk(struct tmpfs_node* node, uint32_t index, bool create)
+{
+    if(index >= node->total_chunks)
+    {
+        return 0;
+    }
+
+    if(!node->chunks[index] && create)
+    {
+        node->chunks[index] = kmalloc(PAGE_SIZE);
+        if(node->chunks[index])
+        {
+            memset(node->chunks[index], 0x00, PAGE_SIZE);
+        }
+    }
+
+    return (char*)node->chunks[index];
+}
+
+/**
+ * @brief Free the chunks after size bytes and zero the rest of the last one
+ */
+static void drop_chunks_after(struct tmpfs_node* node, uint32_t size)
+{
+    uint32_t first = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    for(uint32_t i = first; i < node->total_chunks; i++)
+    {
+        if(node->chunks[i])
+        {
+            kfree(node->chunks[i]);
+            node->chunks[i] = 0;
+        }
+    }
+
+    char* chunk = get_chunk(node, size / PAGE_SIZE, false);
+    if(chunk && size % PAGE_SIZE)
+    {
+        memset(chunk + size % PAGE_SIZE, 0x00, PAGE_SIZE - size % PAGE_SIZE);
+    }
+}
+
+/**
+ * @brief Drop a reference to a node, frees it if it was the last one of an unlinked node
+ * The last close of a linked file gives back what fallocate reserved but was not written
+ */
+static void release_node(struct tmpfs_node* node)
+{
+    node->refs --;
+    if(node->refs > 0)
+    {
+        return;
+    }
+
+    if(!node->linked)
+    {
+        free_node(node);
+    }
+    else if(node->type == TMPFS_NODE_TYPE_FILE)
+    {
+        drop_chunks_after(node, node->size);
+    }
+}
+
+/**
+ * @brief Copy between the buffers and the chunks of a file, holes read as zeros
+ * @param total uint32_t - The bytes to copy, at most the total length of the buffers
+ * @param write bool - Copy the buffers into the file, the chunk slots must be reserved
+ * @return int - 0 if success, otherwise -ENOMEM
+ */
+static int transfer_node_data(struct tmpfs_node* node, uint32_t offset, const struct iovec* iov, uint32_t total, bool write)
+{
+    uint32_t iov_offset = 0;
+    while(total > 0)
+    {
+        if(iov_offset == iov->len)
+        {
+            iov ++;
+            iov_offset = 0;
+            continue;
+        }
+
+        uint32_t chunk_offset = offset % PAGE_SIZE;
+        uint32_t len = PAGE_SIZE - chunk_offset;
+        if(len > iov->len - iov_offset)
+        {
+            len = iov->len - iov_offset;
+        }
+        if(len > total)
+        {
+            len = total;
+        }
+
+        char* buf = (char*)iov->base + iov_offset;
+        char* chunk = get_chunk(node, offset / PAGE_SIZE, write);
+        if(write)
+        {
+            if(!chunk)
+            {
+                return -ENOMEM;
+            }
+            memcpy(chunk + chunk_offset, buf, len);
+        } else if(chunk) {
+            memcpy(buf, chunk + chunk_offset, len);
+        } else {
+            memset(buf, 0x00, len);
+        }
+
+        iov_offset += len;
+        offset += len;
+        total -= len;
+    }
+
+    return 0;
+}
+
+static void* tmpfs_open_file(struct disk* disk, struct path_part* path, FILE_OPEN_MODE mode)
+{
+    struct tmpfs_node* node = find_node(disk, path, 0);
+    if(!node && mode != FILE_MODE_READ)
+    {
+        node = create_node(disk, path, TMPFS_NODE_TYPE_FILE);
+    }
+
+    if(!node || node->type != TMPFS_NODE_TYPE_FILE)
+    {
+        return 0;
+    }
+
+    struct tmpfs_file_descriptor* fd = (struct tmpfs_file_descriptor*)kmalloc(sizeof(struct tmpfs_file_descriptor));
+    if(!fd)
+    {
+        return 0;
+    }
+
+    fd->node = node;
+    fd->offset = 0;
+    node->refs ++;
+
+    if(mode == FILE_MODE_WRITE)
+    {
+        drop_chunks_after(node, 0);
+        node->size = 0;
+    } else if(mode == FILE_MODE_APPEND) {
+        fd->offset = node->size;
+    }
+
+    return fd;
+}
+
+static int tmpfs_readv(struct disk* disk, void* private, const struct iovec* iov, int iovcnt)
+{
+    struct tmpfs_file_descriptor* descriptor = (struct tmpfs_file_descriptor*)private;
+    struct tmpfs_node* node = descriptor->node;
+    uint32_t total = 0;
+    for(int i = 0; i < iovcnt; i++)
+    {
+        total += iov[i].len;
+    }
+
+    uint32_t left = descriptor->offset < node->size ? node->size - descriptor->offset : 0;
+    if(total > left)
+    {
+        total = left;
+    }
+
+    transfer_node_data(node, descriptor->offset, iov, total, false);
+    descriptor->offset += total;
+    return total;
+}
+
+static int tmpfs_writev(struct disk* disk, void* private, const struct iovec* iov, int iovcnt)
+{
+    struct tmpfs_file_descriptor* descriptor = (struct tmpfs_file_descriptor*)private;
+    struct tmpfs_node* node = descriptor->node;
+    uint32_t total = 0;
+    for(int i = 0; i < iovcnt; i++)
+    {
+        total += iov[i].len;
+    }
+
+    uint32_t end = descriptor->offset + total;
+    if(end < descriptor->offset)
+    {
+        return -EINVARG;
+    }
+
+    int res = reserve_chunk_slots(node, (end + PAGE_SIZE - 1) / PAGE_SIZE);
+    if(res < 0)
+    {
+        return res;
+    }
+
+    res = transfer_node_data(node, descriptor->offset, iov, total, true);
+    if(res < 0)
+    {
+        drop_chunks_after(node, node->size); // Keep the bytes past the end zero
+        return res;
+    }
+
+    if(end > node->size)
+    {
+        node->size = end;
+    }
+
+    descriptor->offset = end;
+    return total;
+}
+
+static int tmpfs_read_file(struct disk* disk, void* private, uint32_t size, uint32_t nb, char* out)
+{
+    struct iovec iov = { .base = out, .len = size * nb };
+    int res = tmpfs_readv(disk, private, &iov, 1);
+    return res < 0 ? 0 : res / size;
+}
+
+static int tmpfs_write_file(struct disk* disk, void* private, uint32_t size, uint32_t nb, const char* in)
+{
+    struct iovec iov = { .base = (void*)in, .len = size * nb };
+    int res = tmpfs_writev(disk, private, &iov, 1);
+    return res < 0 ? res : nb;
+}
+
+static int tmpfs_truncate(struct disk* disk, void* private, uint32_t size)
+{
+    struct tmpfs_node* node = ((struct tmpfs_file_descriptor*)private)->node;
+    if(size < node->size)
+    {
+        drop_chunks_after(node, size);
+    }
+
+    node->size = size; // Growing leaves a hole
+    return 0;
+}
+
+/**
+ * @brief Allocate the chunks of a file up to size bytes, chunks past the end are given back on close
+ */
+static int tmpfs_allocate(struct disk* disk, void* private, uint32_t size)
+{
+    struct tmpfs_node* node = ((struct tmpfs_file_descriptor*)private)->node;
+    uint32_t total = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    int res = reserve_chunk_slots(node, total);
+    if(res < 0)
+    {
+        return res;
+    }
+
+    for(uint32_t i = 0; i < total; i++)
+    {
+        if(!get_chunk(node, i, true))
+        {
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Remove a file or an empty directory, its memory is freed once nothing has it open
+ */
+static int tmpfs_unlink(struct disk* disk, struct path_part* path)
+{
+    struct path_part* last = get_last_part(path);
+    struct tmpfs_node* parent = find_node(disk, path, last);
+    struct tmpfs_node* node = parent ? find_node(disk, path, 0) : 0;
+    if(!node)
+    {
+        return -ENOENT;
+    }
+
+    if(node->type == TMPFS_NODE_TYPE_DIRECTORY && node->entries > 0)
+    {
+        return -EINVARG;
+    }
+
+    remove_child(parent, node);
+    if(node->refs == 0)
+    {
+        free_node(node);
+    }
+
+    return 0;
+}
+
+static int tmpfs_mkdir(struct disk* disk, struct path_part* path)
+{
+    if(find_node(disk, path, 0))
+    {
+        return -EINVARG;
+    }
+
+    return create_node(disk, path, TMPFS_NODE_TYPE_DIRECTORY) ? 0 : -ENOENT;
+}
+
+static int tmpfs_stat(struct disk* disk, void* private, struct file_stat* stat)
+{
+    struct tmpfs_node* node = ((struct tmpfs_file_descriptor*)private)->node;
+    stat->filesize = node->size;
+    stat->flags = 0x00;
+    return 0;
+}
+
+static int tmpfs_close(void* private)
+{
+    struct tmpfs_node* node = ((struct tmpfs_file_descriptor*)private)->node;
+    release_node(node);
+    kfree(private);
+    return 0;
+}
+
+static void* tmpfs_open_dir(struct disk* disk, struct path_part* path)
+{
+    struct tmpfs_node* dir = find_node(disk, path, 0);
+    if(!dir || dir->type != TMPFS_NODE_TYPE_DIRECTORY)
+    {
+        return 0;
+    }
+
+    struct tmpfs_dir_stream* stream = (struct tmpfs_dir_stream*)kmalloc(sizeof(struct tmpfs_dir_stream));
+    if(!stream)
+    {
+        return 0;
+    }
+
+    stream->dir = dir;
+    stream->bucket = 0;
+    stream->position = 0;
+    dir->refs ++;
+    return stream;
+}
+
+/**
+ * @brief Return the next child in bucket order, entries added or removed while reading may be missed or repeated
+ * @return int - 1 if an entry is returned, 0 at the end of the directory
+ */
+static int tmpfs_read_dir(struct disk* disk, void* private, struct dirent* dirent)
+{
+    struct tmpfs_dir_stream* stream = (struct tmpfs_dir_stream*)private;
+    struct tmpfs_node* dir = stream->dir;
+    while(stream->bucket < dir->total_buckets)
+    {
+        struct tmpfs_node* node = dir->buckets[stream->bucket];
+        for(uint32_t i = 0; node && i < stream->position; i++)
+        {
+            node = node->hash_next;
+        }
+
+        if(!node)
+        {
+            stream->bucket ++;
+            stream->position = 0;
+            continue;
+        }
+
+        stream->position ++;
+        strcpy(dirent->name, node->name);
+        dirent->size = node->size;
+        dirent->flags = node->type == TMPFS_NODE_TYPE_DIRECTORY ? FILE_STAT_DIRECTORY : 0x00;
+        return 1;
+    }
+
+    return 0;
+}
+
+static int tmpfs_close_dir(void* private)
+{
+    release_node(((struct tmpfs_dir_stream*)private)->dir);
+    kfree(private);
+    return 0;
+}
+
+/**
+ * Resolve the tmpfs filesystem, it takes memory disks and starts with an empty root directory
+ * @param[in] disk struct disk* - The disk to mount
+ * @return int - 0 if the filesystem is resolved successfully, otherwise return an error code
+ */
+int resolve_tmpfs(struct disk* disk)
+{
+    if(disk->type != MEMORY_DISK_TYPE)
+    {
+        return -EINVARG;
+    }
+
+    struct tmpfs_node* root = alloc_node("", 0, TMPFS_NODE_TYPE_DIRECTORY);
+    if(!root)
+    {
+        return -ENOMEM;
+    }
+
+    root->linked = true; // The root is never freed
+    disk->data = root;
+    disk->filesystem = &tmpfs_fs;
+    return 0;
+}
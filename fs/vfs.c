@@ -4,12 +4,32 @@
 #include "print.h"
 #include "string.h"
 #include "fat16.h"
+#include "fat32.h"
+#include "tmpfs.h"
 //#include "types.h"
 #include "disk.h"
 #include "errno.h"
+#include "page.h"
+#include "page_cache.h"
+#include "vnode.h"
+#include "thread.h"
+
+// A descriptor number is generation * MAX_FILE_DESCRIPTORS + slot + 1, the generation wraps before it overflows
+#define FILE_DESCRIPTOR_GENERATIONS (0x7FFFFFFF / MAX_FILE_DESCRIPTORS - 1)
 
 struct filesystem* filesystems[MAX_FILESYSTEMS];
-struct file_descriptor* file_descriptors[MAX_FILE_DESCRIPTORS];
+struct file_descriptor file_descriptors[MAX_FILE_DESCRIPTORS];
+static int free_file_descriptor; // The first slot of the free list, -1 if the table is full
+
+struct mount mounts[MAX_MOUNTS];
+// Lookup cache rebuilt on every mount and umount: the mount at the root of each drive and how many mounts are below it
+static struct mount* drive_mounts[MAX_DRIVES];
+static int drive_submounts[MAX_DRIVES];
+
+// Lock order: mount_lock, then the fs_lock of a disk, then descriptor_lock
+// The fs_lock of a disk also pins its descriptors: they are freed under it and looked up again once it is held
+static struct mutex mount_lock; // The mount table, a path lookup holds it until the disk it found is locked
+static struct mutex descriptor_lock; // The free list of the descriptor table
 
 /**
  * @brief Initialize the filesystem
@@ -48,7 +68,22 @@ void insert_filesystem(struct filesystem* fs)
 static void load_fs()
 {
     memset(filesystems, 0, sizeof(filesystems));
+    insert_filesystem(init_tmpfs()); // Only takes memory disks, so disks are not probed by it
     insert_filesystem(init_fat16());
+    insert_filesystem(init_fat32());
+}
+
+/**
+ * @brief Chain every slot of the descriptor table into the free list
+ */
+static void init_file_descriptors()
+{
+    memset(file_descriptors, 0, sizeof(file_descriptors));
+    for (int i = 0; i < MAX_FILE_DESCRIPTORS; i++)
+    {
+        file_descriptors[i].next_free = i + 1 < MAX_FILE_DESCRIPTORS ? i + 1 : -1;
+    }
+    free_file_descriptor = 0;
 }
 
 /**
@@ -56,42 +91,83 @@ static void load_fs()
  */
 void init_fs()
 {
-    memset(file_descriptors, 0, sizeof(file_descriptors));
+    mutex_init(&mount_lock);
+    mutex_init(&descriptor_lock);
+    init_file_descriptors();
+    init_vnodes();
+    memset(mounts, 0x00, sizeof(mounts));
+    memset(drive_mounts, 0x00, sizeof(drive_mounts));
+    memset(drive_submounts, 0x00, sizeof(drive_submounts));
+    if(page_cache_init() != 0)
+    {
+        print("Page cache disabled\n");
+    }
     load_fs();
 }
 
 /**
- * @brief Get the new file descriptor for fd
+ * @brief Get the new file descriptor for fd, O(1) by taking the head of the free list
  * @param fd: The double pointer to the file descriptor
  * @return 0 if success, otherwise -1
  */
 static int get_new_file_descriptor(struct file_descriptor** fd)
 {
-    int i = 0;
-    for (i = 0; i < MAX_FILE_DESCRIPTORS; i++)
+    mutex_lock(&descriptor_lock);
+    int slot = free_file_descriptor;
+    if (slot < 0)
     {
-        if (file_descriptors[i] == 0)
-        {
-            *fd = kmalloc(sizeof(struct file_descriptor));
-            (*fd)->index = i + 1;
-            file_descriptors[i] = *fd;
-            
-            return 0;
-        }
+        mutex_unlock(&descriptor_lock);
+        return -1;
     }
 
-    return -1;
+    *fd = &file_descriptors[slot];
+    free_file_descriptor = (*fd)->next_free;
+    (*fd)->next_free = -1;
+    (*fd)->index = (*fd)->generation * MAX_FILE_DESCRIPTORS + slot + 1;
+    mutex_unlock(&descriptor_lock);
+    return 0;
 }
 
+/**
+ * @brief Look up a descriptor number, numbers of closed descriptors do not match their slot anymore
+ * @return The file descriptor, 0 if fd is not open
+ */
 static struct file_descriptor* get_file_descriptor(int fd)
 {
-    if(fd < 0 || fd >= MAX_FILE_DESCRIPTORS)
+    if(fd <= 0)
     {
         return 0;
     }
 
     // Descriptor is 1 based
-    return file_descriptors[fd - 1];
+    struct file_descriptor* desc = &file_descriptors[(fd - 1) % MAX_FILE_DESCRIPTORS];
+    return desc->index == fd ? desc : 0;
+}
+
+/**
+ * @brief Look up a descriptor number and lock the filesystem of its disk
+ * fclose() frees descriptors under that lock, so the descriptor is checked again once it is held
+ * and stays valid until the caller unlocks desc->disk->fs_lock
+ * @param type The type the descriptor must have
+ * @return The file descriptor, 0 if fd is not an open descriptor of that type(nothing is locked then)
+ */
+static struct file_descriptor* lock_file_descriptor(int fd, FILE_DESCRIPTOR_TYPE type)
+{
+    struct file_descriptor* desc = get_file_descriptor(fd);
+    struct disk* disk = desc ? desc->disk : 0; // 0 while the slot is being freed or filled
+    if(!disk)
+    {
+        return 0;
+    }
+
+    mutex_lock(&disk->fs_lock);
+    if(desc->index != fd || desc->disk != disk || desc->type != type)
+    {
+        mutex_unlock(&disk->fs_lock);
+        return 0;
+    }
+
+    return desc;
 }
 
 struct filesystem* resolve_fs(struct disk* disk)
@@ -111,6 +187,281 @@ struct filesystem* resolve_fs(struct disk* disk)
     return 0;
 }
 
+/**
+ * @brief Whether the mount point prefix leads path, parts compare case-sensitively
+ * @param[out] rest The parts of path after the prefix, 0 if nothing is left
+ */
+static bool path_has_prefix(struct path_part* path, struct path_root* prefix, struct path_part** rest)
+{
+    struct path_part* part = prefix->first_part;
+    while(part)
+    {
+        if(!path || path->len != part->len || strcmp_prefix(path->part, part->part, part->len) != 0)
+        {
+            return false;
+        }
+
+        path = path->next;
+        part = part->next;
+    }
+
+    *rest = path;
+    return true;
+}
+
+/**
+ * @brief Find the mounted disk a parsed path is on, the deepest mount point leading the path wins
+ * A drive without mounts below its root is served from the cache without comparing any part
+ * @param[out] path The parts of the path inside the mounted filesystem, 0 for its root directory
+ * @return The disk, its filesystem is set; 0 if nothing is mounted for the path
+ */
+static struct disk* get_path_disk(struct path_root* root, struct path_part** path)
+{
+    struct mount* found = drive_mounts[root->drive_no];
+    *path = root->first_part;
+    if(drive_submounts[root->drive_no] == 0)
+    {
+        return found ? found->disk : 0;
+    }
+
+    for(int i = 0; i < MAX_MOUNTS; i++)
+    {
+        struct mount* entry = &mounts[i];
+        struct path_part* rest = 0;
+        if(!entry->used || entry->root.drive_no != root->drive_no || entry->root.total_parts == 0)
+        {
+            continue;
+        }
+
+        if((!found || entry->root.total_parts > found->root.total_parts) && path_has_prefix(root->first_part, &entry->root, &rest))
+        {
+            found = entry;
+            *path = rest;
+        }
+    }
+
+    return found ? found->disk : 0;
+}
+
+/**
+ * @brief get_path_disk() for a call into the filesystem, the disk is returned with its fs_lock held
+ * The disk can not be unmounted until the caller releases fs_lock
+ * @return The locked disk, 0 if nothing is mounted for the path
+ */
+static struct disk* lock_path_disk(struct path_root* root, struct path_part** path)
+{
+    mutex_lock(&mount_lock);
+    struct disk* disk = get_path_disk(root, path);
+    if(disk)
+    {
+        mutex_lock(&disk->fs_lock);
+    }
+    mutex_unlock(&mount_lock);
+    return disk;
+}
+
+static void update_drive_mounts()
+{
+    memset(drive_mounts, 0x00, sizeof(drive_mounts));
+    memset(drive_submounts, 0x00, sizeof(drive_submounts));
+    for(int i = 0; i < MAX_MOUNTS; i++)
+    {
+        if(!mounts[i].used)
+        {
+            continue;
+        }
+
+        int drive = mounts[i].root.drive_no;
+        if(mounts[i].root.total_parts == 0)
+        {
+            drive_mounts[drive] = &mounts[i];
+        } else {
+            drive_submounts[drive] ++;
+        }
+    }
+}
+
+/**
+ * @brief Find the mount whose mount point is exactly root
+ */
+static struct mount* find_mount(struct path_root* root)
+{
+    for(int i = 0; i < MAX_MOUNTS; i++)
+    {
+        struct path_part* rest = 0;
+        if(mounts[i].used && mounts[i].root.drive_no == root->drive_no && mounts[i].root.total_parts == root->total_parts
+            && path_has_prefix(root->first_part, &mounts[i].root, &rest))
+        {
+            return &mounts[i];
+        }
+    }
+
+    return 0;
+}
+
+// mount() with mount_lock held
+static int mount_disk(int disk_id, const char* target)
+{
+    struct disk* disk = get_disk(disk_id);
+    if(!disk)
+    {
+        return -EIO;
+    }
+
+    struct mount* entry = 0;
+    for(int i = 0; i < MAX_MOUNTS; i++)
+    {
+        if(mounts[i].used && mounts[i].disk == disk)
+        {
+            return -EBUSY;
+        }
+
+        if(!mounts[i].used && !entry)
+        {
+            entry = &mounts[i];
+        }
+    }
+
+    if(!entry)
+    {
+        return -ENOMEM;
+    }
+
+    if(strlen(target) > MAX_PATH_LEN)
+    {
+        return -EINVAPTH;
+    }
+
+    strcpy(entry->target, target);
+    if(parse(entry->target, &entry->root) != 0)
+    {
+        return -EINVAPTH;
+    }
+
+    if(find_mount(&entry->root))
+    {
+        return -EBUSY;
+    }
+
+    if(entry->root.first_part)
+    {
+        // The mount point must be a directory of the filesystem it is mounted on
+        struct path_part* path = 0;
+        struct disk* parent = get_path_disk(&entry->root, &path);
+        if(!parent || !parent->filesystem->open_dir)
+        {
+            return -ENOENT;
+        }
+
+        mutex_lock(&parent->fs_lock);
+        void* dir = parent->filesystem->open_dir(parent, path);
+        if(dir)
+        {
+            parent->filesystem->close_dir(dir);
+        }
+        mutex_unlock(&parent->fs_lock);
+        if(!dir)
+        {
+            return -ENOENT;
+        }
+    }
+
+    if(!disk->filesystem)
+    {
+        disk->filesystem = resolve_fs(disk);
+        if(!disk->filesystem)
+        {
+            return -EIO;
+        }
+    }
+
+    entry->disk = disk;
+    entry->used = true;
+    update_drive_mounts();
+    return 0;
+}
+
+/**
+ * @brief Mount a disk at a drive root("2:/") or on a directory of a mounted filesystem("0:/mnt")
+ * The filesystem is probed once here, path lookups use the result
+ * @param disk_id The disk to mount, a disk is mounted at most once
+ * @param target The mount point
+ * @return 0 if success, otherwise a negative error code
+ */
+int mount(int disk_id, const char* target)
+{
+    mutex_lock(&mount_lock);
+    int res = mount_disk(disk_id, target);
+    mutex_unlock(&mount_lock);
+    return res;
+}
+
+// umount() with mount_lock held
+static int unmount_disk(const char* target)
+{
+    struct path_root root;
+    if(parse(target, &root) != 0)
+    {
+        return -EINVAPTH;
+    }
+
+    struct mount* entry = find_mount(&root);
+    if(!entry)
+    {
+        return -EINVARG;
+    }
+
+    for(int i = 0; i < MAX_MOUNTS; i++)
+    {
+        struct path_part* rest = 0;
+        if(mounts[i].used && &mounts[i] != entry && mounts[i].root.drive_no == root.drive_no
+            && path_has_prefix(mounts[i].root.first_part, &root, &rest))
+        {
+            return -EBUSY;
+        }
+    }
+
+    // Calls in progress finish first, the files they open are in the table by then
+    struct disk* disk = entry->disk;
+    int res = 0;
+    mutex_lock(&disk->fs_lock);
+    for(int i = 0; i < MAX_FILE_DESCRIPTORS; i++)
+    {
+        if(file_descriptors[i].index != 0 && file_descriptors[i].disk == disk)
+        {
+            res = -EBUSY;
+            goto out;
+        }
+    }
+
+    if(disk->filesystem->unmount)
+    {
+        res = disk->filesystem->unmount(disk);
+        if(res < 0)
+        {
+            goto out;
+        }
+    }
+
+    memset(entry, 0x00, sizeof(struct mount));
+    update_drive_mounts();
+out:
+    mutex_unlock(&disk->fs_lock);
+    return res;
+}
+
+/**
+ * @brief Unmount the filesystem mounted at target
+ * @return 0 if success, -EBUSY if files are open on it or something is mounted below it, otherwise a negative error code
+ */
+int umount(const char* target)
+{
+    mutex_lock(&mount_lock);
+    int res = unmount_disk(target);
+    mutex_unlock(&mount_lock);
+    return res;
+}
+
 FILE_OPEN_MODE get_file_open_mode(const char* mode)
 {
     if(strcmp(mode, "r") == 0)
@@ -131,75 +482,332 @@ FILE_OPEN_MODE get_file_open_mode(const char* mode)
 
 int fopen(const char* filename, const char* mode)
 {
-    struct path_root* root = parse(filename);
-    if(!root)
+    struct path_root root;
+    if(parse(filename, &root) != 0)
     {
         return -1;
     }
     
-    // Check if just having the root path
-    if(!root->first_part)
+    FILE_OPEN_MODE open_mode = get_file_open_mode(mode); // Get the open mode from "mode"
+    if(open_mode == FILE_MODE_INVALID)
     {
         return -1;
     }
 
-    struct disk* disk = get_disk(root->drive_no); // Get the disk
+    struct path_part* path = 0;
+    struct disk* disk = lock_path_disk(&root, &path); // Get the mounted disk
     if(!disk)
     {
         return -1;
     }
 
-    if(!disk->filesystem)
+    int res = -1;
+    // Check if just having the root path
+    if(!path)
     {
-        return -1;
+        goto out;
     }
 
-    FILE_OPEN_MODE open_mode = get_file_open_mode(mode); // Get the open mode from "mode"
-    if(open_mode == FILE_MODE_INVALID)
+    if(open_mode != FILE_MODE_READ && !disk->filesystem->write_file) // Read-only filesystem
     {
-        return -1;
+        goto out;
     }
 
-    void* data_to_descriptor = (*disk->filesystem->open_file)(disk, root->first_part, open_mode); // Open the file using the filesystem
+    void* data_to_descriptor = (*disk->filesystem->open_file)(disk, path, open_mode); // Open the file using the filesystem
+    if(!data_to_descriptor)
+    {
+        goto out;
+    }
 
     struct file_descriptor* fd = 0;
     if(get_new_file_descriptor(&fd) != 0)
     {
-        return -1;
+        disk->filesystem->close(data_to_descriptor);
+        goto out;
     }
 
     fd->fs = disk->filesystem; // Points to the filesystem
+    fd->mode = open_mode;
+    fd->type = FILE_DESCRIPTOR_FILE;
     fd->data = data_to_descriptor; // Points to the file descriptor provided by the filesystem(contains the fat item and the r/w pointer location)
     fd->disk = disk; // Points to the disk
-    return fd->index;
+    res = fd->index;
+out:
+    mutex_unlock(&disk->fs_lock);
+    return res;
 }
 
 int fread(void* ptr, uint32_t size, uint32_t count, int fd)
 {
-    if(fd < 0 || fd >= MAX_FILE_DESCRIPTORS || size <= 0 || count <= 0)
+    if(size <= 0 || count <= 0)
+    {
+        return -1;
+    }
+
+    struct file_descriptor* file = lock_file_descriptor(fd, FILE_DESCRIPTOR_FILE);
+    if(!file)
+    {
+        return -1;
+    }
+
+    int res = (*file->fs->read_file)(file->disk, file->data, size, count, ptr);
+    mutex_unlock(&file->disk->fs_lock);
+    return res;
+}
+
+int fwrite(const void* ptr, uint32_t size, uint32_t count, int fd)
+{
+    if(size <= 0 || count <= 0)
     {
         return -1;
     }
 
-    struct file_descriptor* file = get_file_descriptor(fd);
+    struct file_descriptor* file = lock_file_descriptor(fd, FILE_DESCRIPTOR_FILE);
     if(!file)
     {
         return -1;
     }
 
-    return (*file->fs->read_file)(file->disk, file->data, size, count, ptr);
+    int res = -1;
+    if(file->mode != FILE_MODE_READ)
+    {
+        res = (*file->fs->write_file)(file->disk, file->data, size, count, ptr);
+    }
+    mutex_unlock(&file->disk->fs_lock);
+    return res;
+}
+
+/**
+ * @brief Read from the current offset into several buffers, filled in order
+ * @return The number of bytes read, less than asked for at the end of the file, otherwise a negative error code
+ */
+int freadv(int fd, const struct iovec* iov, int iovcnt)
+{
+    if(!iov || iovcnt < 0)
+    {
+        return -EINVARG;
+    }
+
+    struct file_descriptor* file = lock_file_descriptor(fd, FILE_DESCRIPTOR_FILE);
+    if(!file)
+    {
+        return -EINVARG;
+    }
+
+    int res = 0;
+    if(file->fs->readv)
+    {
+        res = file->fs->readv(file->disk, file->data, iov, iovcnt);
+        goto out;
+    }
+
+    int total = 0;
+    for(int i = 0; i < iovcnt; i++)
+    {
+        if(iov[i].len == 0)
+        {
+            continue;
+        }
+
+        if((*file->fs->read_file)(file->disk, file->data, iov[i].len, 1, iov[i].base) != 1)
+        {
+            res = total ? total : -EIO;
+            goto out;
+        }
+        total += iov[i].len;
+    }
+
+    res = total;
+out:
+    mutex_unlock(&file->disk->fs_lock);
+    return res;
+}
+
+/**
+ * @brief Write several buffers, in order, at the current offset
+ * @return The number of bytes written, otherwise a negative error code
+ */
+int fwritev(int fd, const struct iovec* iov, int iovcnt)
+{
+    if(!iov || iovcnt < 0)
+    {
+        return -EINVARG;
+    }
+
+    struct file_descriptor* file = lock_file_descriptor(fd, FILE_DESCRIPTOR_FILE);
+    if(!file)
+    {
+        return -EINVARG;
+    }
+
+    int res = -EINVARG;
+    if(file->mode == FILE_MODE_READ)
+    {
+        goto out;
+    }
+
+    if(file->fs->writev)
+    {
+        res = file->fs->writev(file->disk, file->data, iov, iovcnt);
+        goto out;
+    }
+
+    int total = 0;
+    for(int i = 0; i < iovcnt; i++)
+    {
+        if(iov[i].len == 0)
+        {
+            continue;
+        }
+
+        res = (*file->fs->write_file)(file->disk, file->data, iov[i].len, 1, iov[i].base);
+        if(res != 1)
+        {
+            res = total ? total : (res < 0 ? res : -EIO);
+            goto out;
+        }
+        total += iov[i].len;
+    }
+
+    res = total;
+out:
+    mutex_unlock(&file->disk->fs_lock);
+    return res;
+}
+
+/**
+ * @brief Set the size of a file opened for writing, extra data is dropped and new data reads as zeros
+ */
+int ftruncate(int fd, uint32_t size)
+{
+    struct file_descriptor* desc = lock_file_descriptor(fd, FILE_DESCRIPTOR_FILE);
+    if (!desc)
+    {
+        return -EINVARG;
+    }
+
+    int res = -EINVARG;
+    if (desc->mode != FILE_MODE_READ)
+    {
+        res = desc->fs->truncate(desc->disk, desc->data, size);
+    }
+    mutex_unlock(&desc->disk->fs_lock);
+    return res;
+}
+
+/**
+ * @brief Hint that a file will grow to size bytes, so the filesystem can reserve its space up front
+ * The file size does not change, unused space is given back when the file is closed
+ */
+int fallocate(int fd, uint32_t size)
+{
+    struct file_descriptor* desc = lock_file_descriptor(fd, FILE_DESCRIPTOR_FILE);
+    if (!desc)
+    {
+        return -EINVARG;
+    }
+
+    int res = 0;
+    if (desc->mode == FILE_MODE_READ)
+    {
+        res = -EINVARG;
+    }
+    else if (desc->fs->allocate)
+    {
+        res = desc->fs->allocate(desc->disk, desc->data, size);
+    }
+    mutex_unlock(&desc->disk->fs_lock);
+    return res;
+}
+
+/**
+ * @brief Write the pending metadata of a file back to the disk
+ */
+int fsync(int fd)
+{
+    struct file_descriptor* desc = lock_file_descriptor(fd, FILE_DESCRIPTOR_FILE);
+    if (!desc)
+    {
+        return -EIO;
+    }
+
+    int res = 0;
+    if (desc->fs->flush)
+    {
+        res = desc->fs->flush(desc->disk, desc->data);
+    }
+    mutex_unlock(&desc->disk->fs_lock);
+    return res;
+}
+
+int unlink(const char* filename)
+{
+    struct path_root root;
+    struct path_part* path = 0;
+    if(parse(filename, &root) != 0)
+    {
+        return -EINVAPTH;
+    }
+
+    struct disk* disk = lock_path_disk(&root, &path);
+    if(!disk)
+    {
+        return -EIO;
+    }
+
+    int res = -EIO;
+    if(path && disk->filesystem->unlink) // A mount point can not be unlinked
+    {
+        res = disk->filesystem->unlink(disk, path);
+    }
+    mutex_unlock(&disk->fs_lock);
+    return res;
+}
+
+/**
+ * @brief Create an empty directory, its parent must exist
+ * @return 0 if success, otherwise a negative error code
+ */
+int mkdir(const char* path)
+{
+    struct path_root root;
+    struct path_part* part = 0;
+    if(parse(path, &root) != 0)
+    {
+        return -EINVAPTH;
+    }
+
+    struct disk* disk = lock_path_disk(&root, &part);
+    if(!disk)
+    {
+        return -EIO;
+    }
+
+    int res = -EIO;
+    if(part && disk->filesystem->mkdir)
+    {
+        res = disk->filesystem->mkdir(disk, part);
+    }
+    mutex_unlock(&disk->fs_lock);
+    return res;
 }
 
 static void file_free_descriptor(struct file_descriptor* desc)
 {
-    file_descriptors[desc->index-1] = 0x00;
-    kfree(desc);
+    mutex_lock(&descriptor_lock);
+    int slot = desc - file_descriptors;
+    int generation = (desc->generation + 1) % FILE_DESCRIPTOR_GENERATIONS;
+    memset(desc, 0x00, sizeof(struct file_descriptor));
+    desc->generation = generation;
+    desc->next_free = free_file_descriptor;
+    free_file_descriptor = slot;
+    mutex_unlock(&descriptor_lock);
 }
 
 int fstat(int fd, struct file_stat* stat)
 {
     int res = 0;
-    struct file_descriptor* desc = get_file_descriptor(fd);
+    struct file_descriptor* desc = lock_file_descriptor(fd, FILE_DESCRIPTOR_FILE);
     if (!desc)
     {
         res = -EIO;
@@ -207,6 +815,7 @@ int fstat(int fd, struct file_stat* stat)
     }
 
     res = desc->fs->stat(desc->disk, desc->data, stat);
+    mutex_unlock(&desc->disk->fs_lock);
 out:
     return res;
 }
@@ -214,20 +823,308 @@ out:
 int fclose(int fd)
 {
     int res = 0;
-    struct file_descriptor* desc = get_file_descriptor(fd);
+    struct file_descriptor* desc = lock_file_descriptor(fd, FILE_DESCRIPTOR_FILE);
     if (!desc)
     {
         res = -EIO;
         goto out;
     }
 
+    // The filesystem frees its descriptor even when it fails to write the file back
+    struct disk* disk = desc->disk;
     res = desc->fs->close(desc->data);
+    file_free_descriptor(desc);
+    mutex_unlock(&disk->fs_lock);
+out:
+    return res;
+}
+
+/**
+ * @brief Copy bytes from one file to another inside the kernel, from and at the current offsets of the descriptors
+ * Filesystems with a copy method move the data themselves when both files are on the same disk
+ * @return The number of bytes copied, less than len at the end of fd_in or when fd_out is full, otherwise a negative error code
+ */
+int copy_file_range(int fd_in, int fd_out, uint32_t len)
+{
+    struct file_descriptor* in = lock_file_descriptor(fd_in, FILE_DESCRIPTOR_FILE);
+    if(!in)
+    {
+        return -EINVARG;
+    }
+
+    // A descriptor on the disk that is locked can not be closed, it is enough to look it up
+    struct file_descriptor* out = get_file_descriptor(fd_out);
+    if(out && out->disk == in->disk && out->type == FILE_DESCRIPTOR_FILE && in->fs->copy_range)
+    {
+        int res = out->mode == FILE_MODE_READ ? -EINVARG : in->fs->copy_range(in->disk, in->data, out->data, len);
+        mutex_unlock(&in->disk->fs_lock);
+        return res;
+    }
+    mutex_unlock(&in->disk->fs_lock);
+
+    out = lock_file_descriptor(fd_out, FILE_DESCRIPTOR_FILE);
+    if(!out)
+    {
+        return -EINVARG;
+    }
+
+    int res = out->mode == FILE_MODE_READ ? -EINVARG : 0;
+    mutex_unlock(&out->disk->fs_lock);
+    if(res < 0 || len == 0)
+    {
+        return res;
+    }
+
+    uint32_t size = len > COPY_FILE_BUFFER_SIZE ? COPY_FILE_BUFFER_SIZE : len;
+    char* buffer = (char*)kmalloc(size);
+    if(!buffer)
+    {
+        return -ENOMEM;
+    }
+
+    uint32_t done = 0;
+    while(done < len)
+    {
+        uint32_t chunk = len - done > size ? size : len - done;
+        // One disk at a time, the two may be the same, either descriptor may be closed in between
+        in = lock_file_descriptor(fd_in, FILE_DESCRIPTOR_FILE);
+        if(!in)
+        {
+            res = -EINVARG;
+            break;
+        }
+
+        int read = (*in->fs->read_file)(in->disk, in->data, 1, chunk, buffer);
+        mutex_unlock(&in->disk->fs_lock);
+        if(read <= 0)
+        {
+            break;
+        }
+
+        out = lock_file_descriptor(fd_out, FILE_DESCRIPTOR_FILE);
+        if(!out)
+        {
+            res = -EINVARG;
+            break;
+        }
+
+        res = (*out->fs->write_file)(out->disk, out->data, 1, read, buffer);
+        mutex_unlock(&out->disk->fs_lock);
+        if(res < 0)
+        {
+            break;
+        }
+
+        // The bytes read past a short write are lost, only the ones written count
+        done += res;
+        if(res < read)
+        {
+            res = -EIO;
+            break;
+        }
+
+        res = 0;
+        if(read < chunk)
+        {
+            break;
+        }
+    }
+
+    kfree(buffer);
+    return done ? (int)done : res;
+}
+
+/**
+ * @brief Open a directory for reading its entries one at a time
+ * The directory is streamed, so memory use does not depend on its size
+ * @param path The path to the directory, "0:/" for the root directory
+ * @return The directory descriptor if success, otherwise a negative error code
+ */
+int opendir(const char* path)
+{
+    struct path_root root;
+    struct path_part* part = 0;
+    if(parse(path, &root) != 0)
+    {
+        return -EINVAPTH;
+    }
+
+    struct disk* disk = lock_path_disk(&root, &part);
+    if(!disk)
+    {
+        return -EIO;
+    }
+
+    int res = -EIO;
+    if(!disk->filesystem->open_dir)
+    {
+        goto out;
+    }
+
+    void* data_to_descriptor = disk->filesystem->open_dir(disk, part);
+    if(!data_to_descriptor)
+    {
+        res = -ENOENT;
+        goto out;
+    }
+
+    struct file_descriptor* dd = 0;
+    if(get_new_file_descriptor(&dd) != 0)
+    {
+        disk->filesystem->close_dir(data_to_descriptor);
+        res = -ENOMEM;
+        goto out;
+    }
+
+    dd->fs = disk->filesystem;
+    dd->mode = FILE_MODE_READ;
+    dd->type = FILE_DESCRIPTOR_DIRECTORY;
+    dd->data = data_to_descriptor;
+    dd->disk = disk;
+    res = dd->index;
+out:
+    mutex_unlock(&disk->fs_lock);
+    return res;
+}
+
+/**
+ * @brief Read the next entry of an open directory
+ * @return 1 if an entry is returned, 0 at the end of the directory, otherwise a negative error code
+ */
+int readdir(int dd, struct dirent* dirent)
+{
+    if (!dirent)
+    {
+        return -EINVARG;
+    }
+
+    struct file_descriptor* desc = lock_file_descriptor(dd, FILE_DESCRIPTOR_DIRECTORY);
+    if (!desc)
+    {
+        return -EINVARG;
+    }
+
+    int res = desc->fs->read_dir(desc->disk, desc->data, dirent);
+    mutex_unlock(&desc->disk->fs_lock);
+    return res;
+}
+
+int closedir(int dd)
+{
+    int res = 0;
+    struct file_descriptor* desc = lock_file_descriptor(dd, FILE_DESCRIPTOR_DIRECTORY);
+    if (!desc)
+    {
+        res = -EIO;
+        goto out;
+    }
+
+    struct disk* disk = desc->disk;
+    res = desc->fs->close_dir(desc->data);
     if(res == 0)
     {
         file_free_descriptor(desc);
-    
     }
+    mutex_unlock(&disk->fs_lock);
 out:
     return res;
 }
 
+/**
+ * @brief Map pages of a file into a page directory, the mapping shares the pages of the page cache
+ * The mapping is read-only, changes to the file show up in it
+ * @param offset The file offset to map from, page aligned
+ * @param length The bytes to map, rounded up to whole pages that must start within the file
+ * @param virtual_addr Where to map the pages, page aligned
+ * @return 0 if success, -EBUSY if a page of the range is mapped already, otherwise a negative error code
+ */
+int mmap(int fd, uint32_t offset, uint32_t length, uint32_t* directory, void* virtual_addr)
+{
+    if(offset % PAGE_SIZE != 0 || !is_page_aligned(virtual_addr) || length == 0)
+    {
+        return -EINVARG;
+    }
+
+    // Mapping over a present page would leak the page cache hold of the old mapping, munmap() it first
+    uint32_t total = (length + PAGE_SIZE - 1) / PAGE_SIZE;
+    for(uint32_t i = 0; i < total; i++)
+    {
+        if(get_paging(directory, (char*)virtual_addr + i * PAGE_SIZE) & PAGE_IS_PRESENT)
+        {
+            return -EBUSY;
+        }
+    }
+
+    struct file_descriptor* desc = lock_file_descriptor(fd, FILE_DESCRIPTOR_FILE);
+    if(!desc)
+    {
+        return -EINVARG;
+    }
+
+    int res = 0;
+    if(!desc->fs->map_page)
+    {
+        res = -EINVARG;
+        total = 0;
+    }
+
+    for(uint32_t i = 0; i < total; i++)
+    {
+        void* page = 0;
+        char* addr = (char*)virtual_addr + i * PAGE_SIZE;
+        res = desc->fs->map_page(desc->disk, desc->data, offset / PAGE_SIZE + i, &page);
+        if(res < 0)
+        {
+            munmap(directory, virtual_addr, i * PAGE_SIZE);
+            break;
+        }
+
+        res = set_paging(directory, addr, (uint32_t)page | PAGE_IS_PRESENT | PAGE_ACCESS_FROM_ALL);
+        if(res < 0)
+        {
+            struct page_cache_page* cached = page_cache_from_address(page);
+            if(cached)
+            {
+                page_cache_release(cached);
+            }
+            munmap(directory, virtual_addr, i * PAGE_SIZE);
+            break;
+        }
+        invalidate_page(addr);
+    }
+    mutex_unlock(&desc->disk->fs_lock);
+
+    return res < 0 ? res : 0;
+}
+
+/**
+ * @brief Remove the pages of a mapping, the page cache may reuse them afterwards
+ * @return 0 if success, otherwise a negative error code
+ */
+int munmap(uint32_t* directory, void* virtual_addr, uint32_t length)
+{
+    if(!is_page_aligned(virtual_addr))
+    {
+        return -EINVARG;
+    }
+
+    uint32_t total = (length + PAGE_SIZE - 1) / PAGE_SIZE;
+    for(uint32_t i = 0; i < total; i++)
+    {
+        char* addr = (char*)virtual_addr + i * PAGE_SIZE;
+        uint32_t entry = get_paging(directory, addr);
+        if(entry & PAGE_IS_PRESENT)
+        {
+            struct page_cache_page* page = page_cache_from_address((void*)(entry & 0xFFFFF000));
+            if(page)
+            {
+                page_cache_release(page);
+            }
+        }
+
+        set_paging(directory, addr, 0x00);
+        invalidate_page(addr);
+    }
+
+    return 0;
+}
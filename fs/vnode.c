@@ -0,0 +1,138 @@
+#include "vnode.h"
+#include "config.h"
+#include "string.h"
+#include "thread.h"
+
+/**
+ * Table of open files, looked up by (disk, id) so repeated opens of a file share one vnode
+ * The slots are preallocated, every open file holds at least one file descriptor
+ * The table is shared by the mounts, vnode_lock guards it
+ */
+static struct vnode vnodes[MAX_VNODES];
+static struct vnode* buckets[VNODE_BUCKETS];
+static struct vnode* free_vnodes;
+static struct mutex vnode_lock;
+
+static uint32_t vnode_hash(struct disk* disk, uint64_t id)
+{
+    return ((uint32_t)disk ^ (((uint32_t)id ^ (uint32_t)(id >> 32)) * 2654435761u)) % VNODE_BUCKETS;
+}
+
+/**
+ * @brief Chain every slot of the table into the free list
+ */
+void init_vnodes()
+{
+    mutex_init(&vnode_lock);
+    memset(vnodes, 0x00, sizeof(vnodes));
+    memset(buckets, 0x00, sizeof(buckets));
+    free_vnodes = 0;
+    for(int i = MAX_VNODES - 1; i >= 0; i--)
+    {
+        vnodes[i].hash_next = free_vnodes;
+        free_vnodes = &vnodes[i];
+    }
+}
+
+/**
+ * @brief Find the vnode of an open file and take a reference to it
+ * @return The vnode, 0 if the file is not open
+ */
+struct vnode* vnode_get(struct disk* disk, uint64_t id)
+{
+    mutex_lock(&vnode_lock);
+    struct vnode* vnode = buckets[vnode_hash(disk, id)];
+    while(vnode && !(vnode->disk == disk && vnode->id == id))
+    {
+        vnode = vnode->hash_next;
+    }
+
+    if(vnode)
+    {
+        vnode->refs ++;
+    }
+    mutex_unlock(&vnode_lock);
+    return vnode;
+}
+
+/**
+ * @brief Add the vnode of a file that is not open yet, the caller holds its only reference
+ * @return The vnode, 0 if the table is full
+ */
+struct vnode* vnode_create(struct disk* disk, uint64_t id, void* data)
+{
+    mutex_lock(&vnode_lock);
+    struct vnode* vnode = free_vnodes;
+    if(!vnode)
+    {
+        mutex_unlock(&vnode_lock);
+        return 0;
+    }
+
+    free_vnodes = vnode->hash_next;
+    vnode->disk = disk;
+    vnode->id = id;
+    vnode->refs = 1;
+    vnode->data = data;
+    vnode->hashed = true;
+
+    struct vnode** bucket = &buckets[vnode_hash(disk, id)];
+    vnode->hash_next = *bucket;
+    *bucket = vnode;
+    mutex_unlock(&vnode_lock);
+    return vnode;
+}
+
+static void unhash_vnode(struct vnode* vnode)
+{
+    if(!vnode->hashed)
+    {
+        return;
+    }
+
+    struct vnode** link = &buckets[vnode_hash(vnode->disk, vnode->id)];
+    while(*link && *link != vnode)
+    {
+        link = &(*link)->hash_next;
+    }
+
+    if(*link)
+    {
+        *link = vnode->hash_next;
+    }
+
+    vnode->hash_next = 0;
+    vnode->hashed = false;
+}
+
+/**
+ * @brief Hide a vnode from vnode_get(), its file was unlinked and the id may be given to a new file
+ */
+void vnode_unhash(struct vnode* vnode)
+{
+    mutex_lock(&vnode_lock);
+    unhash_vnode(vnode);
+    mutex_unlock(&vnode_lock);
+}
+
+/**
+ * @brief Drop a reference, the slot is freed with the last one
+ * @return The references left, on 0 the caller frees the data it got from the vnode
+ */
+int vnode_put(struct vnode* vnode)
+{
+    mutex_lock(&vnode_lock);
+    int refs = -- vnode->refs;
+    if(refs > 0)
+    {
+        mutex_unlock(&vnode_lock);
+        return refs;
+    }
+
+    unhash_vnode(vnode);
+    memset(vnode, 0x00, sizeof(struct vnode));
+    vnode->hash_next = free_vnodes;
+    free_vnodes = vnode;
+    mutex_unlock(&vnode_lock);
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "gdt.h"
 #include "print.h"
+#include "config.h"
 
 void encode_gdt_entry(uint8_t* dest, struct gdt_structure src)
 {
@@ -35,4 +36,22 @@ void gdt_structure_to_gdt_entry(struct gdt_structure *gdt, struct gdt_entry *ent
     for(int i = 0; i < total_entries; i ++ ){
         encode_gdt_entry((uint8_t*)&entry[i], gdt[i]); // encode a simpler structured gdt to a normal gdt
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Build the GDT of a CPU: flat kernel and user segments, the TSS of the CPU and its per-CPU data segment
+ * Reference: https://wiki.osdev.org/Global_Descriptor_Table
+ */
+void gdt_init_cpu(struct gdt_entry *entry, void *tss, uint32_t tss_size, void *percpu, uint32_t percpu_size){
+    struct gdt_structure gdt[TOTAL_GDT_SEGMENTS] = {
+        {.base = 0x00, .limit = 0x00, .type = 0x00}, // null segment
+        {.base = 0x00, .limit = 0xffffffff, .type = 0x9a}, // kernel code segment
+        {.base = 0x00, .limit = 0xffffffff, .type = 0x92}, // kernel data segment
+        {.base = 0x00, .limit = 0xffffffff, .type = 0xf8}, // User code segment
+        {.base = 0x00, .limit = 0xffffffff, .type = 0xf2}, // User data segment
+        {.base = (uint32_t)tss, .limit = tss_size, .type = 0xe9}, // TSS segment
+        {.base = (uint32_t)percpu, .limit = percpu_size - 1, .type = 0x92}, // Per-CPU data segment(%gs)
+    };
+
+    gdt_structure_to_gdt_entry(gdt, entry, TOTAL_GDT_SEGMENTS);
+}
@@ -0,0 +1,69 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include "types.h"
+
+// Atomic operations on 32 bit values shared between CPUs, every one is also a full compiler barrier
+
+static inline uint32_t __attribute__((always_inline)) atomic_xchg(volatile uint32_t* ptr, uint32_t value)
+{
+    asm volatile("xchgl %0, %1" : "+r"(value), "+m"(*ptr) : : "memory"); // xchg with memory is always locked
+    return value;
+}
+
+// Store desired if *ptr still holds expected, return whether it did
+static inline bool __attribute__((always_inline)) atomic_cmpxchg(volatile uint32_t* ptr, uint32_t expected, uint32_t desired)
+{
+    uint8_t success;
+    asm volatile("lock cmpxchgl %3, %1\n\t"
+                 "sete %0"
+                 : "=q"(success), "+m"(*ptr), "+a"(expected)
+                 : "r"(desired)
+                 : "memory");
+    return success;
+}
+
+// Add value and return what *ptr held before
+static inline uint32_t __attribute__((always_inline)) atomic_fetch_add(volatile uint32_t* ptr, uint32_t value)
+{
+    asm volatile("lock xaddl %0, %1" : "+r"(value), "+m"(*ptr) : : "memory");
+    return value;
+}
+
+// Order earlier stores before later loads, mfence needs SSE2 so use a locked add
+static inline void __attribute__((always_inline)) memory_barrier()
+{
+    asm volatile("lock addl $0, (%%esp)" : : : "memory");
+}
+
+static inline void __attribute__((always_inline)) cpu_relax()
+{
+    asm volatile("pause" : : : "memory");
+}
+
+/**
+ * A lock spinning on another CPU, hold it with interrupts disabled so the holder is not preempted on its own CPU
+ */
+struct spinlock
+{
+    volatile uint32_t locked;
+};
+
+static inline void __attribute__((always_inline)) spin_lock(struct spinlock* lock)
+{
+    while(atomic_xchg(&lock->locked, 1))
+    {
+        while(lock->locked)
+        {
+            cpu_relax();
+        }
+    }
+}
+
+static inline void __attribute__((always_inline)) spin_unlock(struct spinlock* lock)
+{
+    asm volatile("" : : : "memory"); // x86 stores are not reordered with earlier loads and stores
+    lock->locked = 0;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "types.h"
+
+struct trap_frame;
+
+// Input clock of the 8253/8254 PIT
+#define PIT_FREQUENCY 1193182
+
+// Timer interrupt vector, IRQ0 after head.S remaps the master PIC to 0x20
+#define TIMER_VECTOR 0x20
+#define TIMER_IRQ 0
+
+typedef void (*TIMER_HANDLER)();
+
+// Read the time stamp counter, cycles since reset
+static inline uint64_t __attribute__((always_inline)) read_tsc()
+{
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/**
+ * @brief Divide a 64 bit value by a 32 bit one with one divl, there is no libgcc for 64 bit division
+ * The quotient must fit 32 bits
+ */
+static inline uint32_t __attribute__((always_inline)) div64_32(uint64_t dividend, uint32_t divisor)
+{
+    uint32_t quotient, remainder;
+    asm("divl %4" : "=a"(quotient), "=d"(remainder) : "a"((uint32_t)dividend), "d"((uint32_t)(dividend >> 32)), "rm"(divisor));
+    return quotient;
+}
+
+void clock_init();
+uint64_t clock_ns();
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+uint32_t clock_tsc_khz();
+uint32_t clock_ticks();
+
+void timer_periodic(uint32_t hz);
+int timer_oneshot(uint32_t us);
+void timer_set_handler(TIMER_HANDLER handler);
+void timer_interrupt_handler(struct trap_frame* frame);
+void timer_use_local();
+void timer_local_tick();
+
+#endif
@@ -15,10 +15,66 @@
 #define SECTOR_SIZE 512
 
 #define MAX_FILESYSTEMS 10
+// Mounted filesystems, and drive numbers("0:/" to "9:/")
+#define MAX_MOUNTS 8
+#define MAX_DRIVES 10
+// Size of the preallocated descriptor table, can be overridden with -DMAX_FILE_DESCRIPTORS=n
+#ifndef MAX_FILE_DESCRIPTORS
 #define MAX_FILE_DESCRIPTORS 512
+#endif
 
-#define TOTAL_GDT_SEGMENTS 6
+// Bounce buffer of copy_file_range(), rounded down to whole clusters by FAT
+#define COPY_FILE_BUFFER_SIZE (64*1024)
+
+// Open files(vnodes), every open file holds a descriptor; hash buckets of the vnode table
+#define MAX_VNODES MAX_FILE_DESCRIPTORS
+#define VNODE_BUCKETS 64
+
+// File pages kept by the page cache(4KB each) and its hash table size
+#define PAGE_CACHE_PAGES 256
+#define PAGE_CACHE_BUCKETS 64
+
+// Disk id of the in-memory disk and where its tmpfs is mounted, e.g. "1:/scratch.txt"
+#define MEMORY_DISK_ID 1
+#define TMPFS_MOUNT_POINT "1:/"
+// Partitions of disk 0 get the disk ids from PARTITION_DISK_ID_BASE on and are mounted at the drive of the same number
+#define PARTITION_DISK_ID_BASE 2
+#define MAX_PARTITIONS 8
+// Initial hash buckets of a tmpfs directory, a power of two
+#define TMPFS_DIR_BUCKETS 16
+
+// Rate of the periodic timer interrupt
+#define CLOCK_TICK_HZ 100
+// The TSC is counted over CLOCK_CALIBRATE_ROUNDS PIT intervals of CLOCK_CALIBRATE_MS each(at most 54ms)
+#define CLOCK_CALIBRATE_MS 10
+#define CLOCK_CALIBRATE_ROUNDS 3
+
+// Kernel stack of every thread, timer ticks a thread runs before it is preempted
+#define THREAD_STACK_SIZE (16*1024)
+#define THREAD_TIME_SLICE 5
+// Slots of the run queue of every CPU(a power of two), also the limit of threads so a queue never overflows
+#define RUN_QUEUE_SIZE 256
+#define MAX_THREADS RUN_QUEUE_SIZE
+// tss.esp0 while the boot thread(main) runs
+#define BOOT_THREAD_ESP0 0x600000
+
+// CPUs that are started, the others listed by the firmware stay halted
+#define MAX_CPUS 8
+// Page below 1MB the APs start from in real mode, and the boot stack of every AP
+#define SMP_TRAMPOLINE_ADDR 0x2000
+#define SMP_AP_STACK_SIZE (16*1024)
+#define SMP_AP_TIMEOUT_MS 100
+
+// Bytes between the entry stubs of two vectors in int/int.S
+#define INTERRUPT_STUB_SIZE 16
+
+// Scancodes and decoded characters the keyboard buffers, a power of two
+#define KEYBOARD_RING_SIZE 128
+
+#define TOTAL_GDT_SEGMENTS 7
 #define DATA_SELECTOR 0X10
 #define CODE_SELECTOR 0X08
+#define TSS_SELECTOR 0X28
+#define PERCPU_SELECTOR 0X30
 
 #endif
\ No newline at end of file
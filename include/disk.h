@@ -1,39 +1,72 @@
 #ifndef DISK_H
 #define DISK_H
 
+#include "thread.h"
+
 // Represents a real physical disk
 #define REAL_DISK_TYPE 0
+// Represents a disk with no device behind it, its filesystem keeps everything in memory
+#define MEMORY_DISK_TYPE 1
+
+// Most sectors one ATA PIO command can transfer
+#define DISK_MAX_SECTORS_PER_REQUEST 256
+// The ATA PIO commands take 28-bit LBAs, sectors from here on can not be addressed
+#define DISK_MAX_LBA 0x10000000
 
 typedef unsigned int disk_type;
+
+// Request counters of a disk, one request is one ATA command
+struct disk_stats
+{
+    unsigned int read_requests;
+    unsigned int read_sectors;
+    unsigned int write_requests;
+    unsigned int write_sectors;
+};
+
 struct disk{
     disk_type type;
     unsigned int sector_size;
 
     int disk_id;
 
+    // Where the disk starts on the device and how many sectors it has(0 for the whole device), set for partitions
+    unsigned int lba_offset;
+    unsigned int total_sectors;
+
+    struct disk_stats stats;
+
     struct filesystem* filesystem;
+    // Held across every call into the filesystem while the disk is mounted, the filesystem runs one call at a time
+    // Initialized once with the disk, a lookup may still lock it after an unmount
+    struct mutex fs_lock;
 
     void* data;
 };
 
 
 // Represents a stream of data from a disk. 
-// @param pos pos is the current position in the stream
+// @param pos pos is the current byte position in the stream, 64-bit as a volume may be larger than 4 GiB
 // @param disk disk is the pointer to disk that the stream is reading from
 struct disk_stream
 {
-    int pos;
+    unsigned long long pos;
     struct disk* disk;
 };
 
 // int read_disk_sector(int lba, int total, void* buf);
 struct disk* get_disk(int index);
 void search_and_init_disk();
+void init_disk_irq();
 int read_disk_block(struct disk* _disk, unsigned int lba, int total, void* buf);
+int write_disk_block(struct disk* _disk, unsigned int lba, int total, void* buf);
+int flush_disk_cache(struct disk* _disk);
+void print_disk_stats(struct disk* _disk);
 
 struct disk_stream* create_disk_stream(int disk_id);
 void destroy_disk_stream(struct disk_stream* stream);
-int seek_disk_stream(struct disk_stream* stream, int pos);
+int seek_disk_stream(struct disk_stream* stream, unsigned long long pos);
 int read_disk_stream(struct disk_stream* stream, int total, void* out);
+int write_disk_stream(struct disk_stream* stream, int total, const void* in);
 
 #endif
\ No newline at end of file
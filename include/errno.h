@@ -6,5 +6,9 @@
 #define EINVARG 2
 #define ENOMEM 3
 #define EINVAPTH 4
+#define ENOSPC 5
+#define ENOENT 6
+#define EBUSY 7
+#define ENOTDIR 8
 
 #endif
\ No newline at end of file
@@ -2,10 +2,77 @@
 #define FAT16_H
 
 #include "vfs.h"
+#include "types.h"
+
+// FAT variants served by the cluster, FAT and directory code in fs/fat16/fat16.c
+#define FAT_TYPE_16 16
+#define FAT_TYPE_32 32
 
 struct filesystem;
 
+// BIOS parameter block fields common to every FAT variant
+struct fat_header{
+    uint8_t jump[3];
+    uint8_t oem[8];
+    uint16_t bytes_per_sector;
+    uint8_t sectors_per_cluster;
+    uint16_t reserved_sectors;
+    uint8_t fat_count;
+    uint16_t root_entry_count;
+    uint16_t total_sectors;
+    uint8_t media_type;
+    uint16_t sectors_per_fat;
+    uint16_t sectors_per_track;
+    uint16_t head_count;
+    uint32_t hidden_sectors;
+    uint32_t total_sectors_large;
+} __attribute__((packed));
+
+// Called on flush so a driver can record the free cluster count on the volume(FAT32 FSInfo)
+typedef int (*FAT_SYNC_INFO)(struct disk* disk, uint32_t info_sector, uint32_t free_clusters, uint32_t next_free);
+
+/**
+ * Volume layout handed to fat_mount() by a FAT driver once it has parsed the boot sector
+ * @param type int - FAT_TYPE_16 or FAT_TYPE_32
+ * @param header struct fat_header - The common BIOS parameter block
+ * @param fat_sectors uint32_t - Sectors per FAT
+ * @param root_cluster uint32_t - First cluster of the root directory, 0 if the root directory is the fixed area after the FATs
+ * @param free_clusters uint32_t - Free cluster count recorded on the volume, 0xFFFFFFFF if unknown
+ * @param next_free uint32_t - Where allocation should start, 0 if unknown
+ * @param info_sector uint32_t - Sector passed to sync_info
+ * @param sync_info FAT_SYNC_INFO - Optional, 0 if the volume does not record its free cluster count
+ */
+struct fat_volume{
+    int type;
+    struct fat_header header;
+    uint32_t fat_sectors;
+    uint32_t root_cluster;
+    uint32_t free_clusters;
+    uint32_t next_free;
+    uint32_t info_sector;
+    FAT_SYNC_INFO sync_info;
+};
+
 struct filesystem* init_fat16();
 int resolve_fat16(struct disk* disk);
+int fat_mount(struct disk* disk, struct filesystem* fs, struct fat_volume* volume);
+
+// Filesystem methods shared by the FAT16 and FAT32 drivers
 void* fat16_open_file(struct disk* disk, struct path_part* path, FILE_OPEN_MODE mode);
-#endif // FAT16_H
\ No newline at end of file
+int fat16_read_file(struct disk* disk, void* fd, uint32_t size, uint32_t nb, char* out);
+int fat16_write_file(struct disk* disk, void* fd, uint32_t size, uint32_t nb, const char* in);
+int fat16_truncate(struct disk* disk, void* private, uint32_t size);
+int fat16_allocate(struct disk* disk, void* private, uint32_t size);
+int fat16_flush(struct disk* disk, void* private);
+int fat16_unlink(struct disk* disk, struct path_part* path);
+int fat16_stat(struct disk* disk, void* private, struct file_stat* stat);
+int fat16_close(void* private);
+void* fat16_open_dir(struct disk* disk, struct path_part* path);
+int fat16_read_dir(struct disk* disk, void* private, struct dirent* dirent);
+int fat16_close_dir(void* private);
+int fat16_readv(struct disk* disk, void* private, const struct iovec* iov, int iovcnt);
+int fat16_writev(struct disk* disk, void* private, const struct iovec* iov, int iovcnt);
+int fat16_unmount(struct disk* disk);
+int fat16_copy_range(struct disk* disk, void* in, void* out, uint32_t len);
+int fat16_map_page(struct disk* disk, void* private, uint32_t index, void** page);
+#endif // FAT16_H
@@ -0,0 +1,10 @@
+#ifndef FAT32_H
+#define FAT32_H
+
+#include "vfs.h"
+
+struct filesystem;
+
+struct filesystem* init_fat32();
+int resolve_fat32(struct disk* disk);
+#endif // FAT32_H
@@ -21,4 +21,5 @@ struct gdt_structure
 
 void load_gdt(struct gdt_entry *gdt, uint16_t size);
 void gdt_structure_to_gdt_entry(struct gdt_structure *gdt, struct gdt_entry *entry,int total_entries);
+void gdt_init_cpu(struct gdt_entry *entry, void *tss, uint32_t tss_size, void *percpu, uint32_t percpu_size);
 #endif
\ No newline at end of file
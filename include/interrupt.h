@@ -0,0 +1,82 @@
+#ifndef INTERRUPT_H
+#define INTERRUPT_H
+
+#include "types.h"
+
+// Vector of ISA IRQ 0, head.S remaps the 8259s to 0x20-0x2F and the IOAPIC keeps the same vectors
+#define IRQ_BASE_VECTOR 0x20
+#define KEYBOARD_IRQ 1
+#define ATA_PRIMARY_IRQ 14
+
+#define EFLAGS_IF 0x200
+
+#define TOTAL_VECTORS 256
+// Vectors 0-31 are CPU exceptions
+#define EXCEPTION_VECTORS 32
+#define DIVIDE_ERROR_VECTOR 0
+#define INVALID_OPCODE_VECTOR 6
+#define DOUBLE_FAULT_VECTOR 8
+#define GENERAL_PROTECTION_VECTOR 13
+#define PAGE_FAULT_VECTOR 14
+
+/**
+ * Registers of the interrupted code, built by interrupt_common in int/int.S, lowest address first
+ * @param vector uint32_t - Interrupt vector that fired
+ * @param error_code uint32_t - Pushed by the CPU for some exceptions, 0 otherwise
+ * @param user_esp uint32_t - Only there if the interrupt came from ring 3, like user_ss
+ */
+struct trap_frame
+{
+    uint32_t gs;
+    uint32_t fs;
+    uint32_t es;
+    uint32_t ds;
+    uint32_t edi; // pushal
+    uint32_t esi;
+    uint32_t ebp;
+    uint32_t kernel_esp;
+    uint32_t ebx;
+    uint32_t edx;
+    uint32_t ecx;
+    uint32_t eax;
+    uint32_t vector;
+    uint32_t error_code;
+    uint32_t eip; // Pushed by the CPU
+    uint32_t cs;
+    uint32_t eflags;
+    uint32_t user_esp;
+    uint32_t user_ss;
+} __attribute__((packed));
+
+typedef void (*INTERRUPT_HANDLER)(struct trap_frame* frame);
+
+/**
+ * Instrumentation of one vector on one CPU, in TSC cycles
+ * @param count uint32_t - Times the vector fired
+ * @param switched uint32_t - Runs that ended in a thread switch, their time is not counted since it includes other threads
+ * @param cycles uint64_t - From interrupt_dispatch() to its return, the deferred work included
+ * @param irq_off_cycles uint64_t - Part of cycles with interrupts disabled, i.e. the handler itself
+ */
+struct interrupt_stats
+{
+    uint32_t count;
+    uint32_t switched;
+    uint64_t cycles;
+    uint32_t max_cycles;
+    uint64_t irq_off_cycles;
+    uint32_t max_irq_off_cycles;
+};
+
+void idt_init();
+void idt_load();
+int interrupt_register(int vector, INTERRUPT_HANDLER handler);
+void interrupt_dispatch(struct trap_frame* frame);
+void print_interrupt_stats();
+void irq_eoi(int irq);
+void irq_use_apic();
+void pic_disable();
+
+// int/exception.c
+void exception_init();
+
+#endif
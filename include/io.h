@@ -41,4 +41,21 @@ static inline uint16_t __attribute__((always_inline)) inw(uint16_t port) {
     return data;
 }
 
+//关中断，返回之前的eflags，交给irq_restore()恢复
+static inline uint32_t __attribute__((always_inline)) irq_save() {
+    uint32_t flags;
+    asm volatile("pushfl;\n\t""popl %0;\n\t""cli"
+        :"=r"(flags)
+        :
+        :"memory");
+    return flags;
+}
+
+//恢复irq_save()之前的中断状态
+static inline void __attribute__((always_inline)) irq_restore(uint32_t flags) {
+    if (flags & 0x200) {
+        asm volatile("sti":::"memory");
+    }
+}
+
 #endif
\ No newline at end of file
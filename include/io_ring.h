@@ -0,0 +1,88 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include "types.h"
+#include "vfs.h"
+#include "thread.h"
+
+typedef unsigned char IO_RING_OP;
+enum
+{
+    IO_RING_OP_NOP,
+    IO_RING_OP_READ, // freadv() of one buffer on fd
+    IO_RING_OP_WRITE, // fwritev() of one buffer on fd
+    IO_RING_OP_READV, // freadv() of buf as struct iovec[len]
+    IO_RING_OP_WRITEV, // fwritev() of buf as struct iovec[len]
+    IO_RING_OP_FSYNC,
+    IO_RING_OP_READ_BLOCK, // len sectors from sector offset of disk fd
+    IO_RING_OP_WRITE_BLOCK
+};
+
+/**
+ * A submission queue entry
+ * @param opcode IO_RING_OP - The operation
+ * @param fd int - The file descriptor, or the disk number of a block operation
+ * @param buf void* - The buffer(or the iovec array)
+ * @param len uint32_t - Bytes for file operations, iovec count for vectored ones, sectors for block ones
+ * @param offset uint32_t - The first sector of a block operation, file operations use the descriptor's offset
+ * @param user_data uint32_t - Copied to the completion untouched
+ */
+struct io_sqe
+{
+    IO_RING_OP opcode;
+    int fd;
+    void* buf;
+    uint32_t len;
+    uint32_t offset;
+    uint32_t user_data;
+};
+
+/**
+ * A completion queue entry
+ * @param user_data uint32_t - The user_data of the submission
+ * @param res int - The result of the operation, bytes moved or a negative error code
+ */
+struct io_cqe
+{
+    uint32_t user_data;
+    int res;
+};
+
+/**
+ * A pair of submission and completion rings
+ * The head and tail indices run freely and are masked on access, so head == tail means empty
+ * The caller produces submissions and consumes completions, the io_ring worker thread does the opposite
+ * @param sqe_tail uint32_t - Entries handed out by io_ring_get_sqe(), io_ring_submit() publishes them as sq_tail
+ * @param cq_wait struct wait_queue - Callers sleeping in io_ring_wait_cqe() or io_ring_free()
+ * @param queued bool - The ring is on the list of the worker, or being serviced by it
+ * @param next struct io_ring* - Next ring on the list of the worker
+ */
+struct io_ring
+{
+    uint32_t entries; // Power of two
+    uint32_t mask;
+
+    uint32_t sqe_tail;
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    struct io_sqe* sqes;
+
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    struct io_cqe* cqes;
+
+    struct wait_queue cq_wait;
+    volatile bool queued;
+    struct io_ring* next;
+};
+
+void init_io_rings();
+int io_ring_init(struct io_ring* ring, uint32_t entries);
+void io_ring_free(struct io_ring* ring);
+struct io_sqe* io_ring_get_sqe(struct io_ring* ring);
+int io_ring_submit(struct io_ring* ring);
+struct io_cqe* io_ring_peek_cqe(struct io_ring* ring);
+struct io_cqe* io_ring_wait_cqe(struct io_ring* ring);
+void io_ring_cqe_seen(struct io_ring* ring);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+#include "types.h"
+
+// Registers reached through the IOREGSEL/IOWIN window, Reference: https://wiki.osdev.org/IOAPIC
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDIRECTION 0x10 // Two registers per pin, low word first
+
+#define IOAPIC_PIN_MASKED 0x10000
+#define IOAPIC_PIN_LEVEL 0x8000
+#define IOAPIC_PIN_ACTIVE_LOW 0x2000
+
+// MPS INTI flags of an interrupt source override: bits 0-1 polarity, bits 2-3 trigger mode, 3 means low/level
+#define IRQ_FLAGS_ACTIVE_LOW 0x3
+#define IRQ_FLAGS_LEVEL 0xC
+
+void ioapic_init(uint32_t address);
+int ioapic_total_pins();
+void ioapic_set_pin(uint32_t pin, uint8_t vector, uint16_t flags, uint8_t apic_id);
+void ioapic_mask_pin(uint32_t pin);
+
+#endif
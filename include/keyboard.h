@@ -0,0 +1,37 @@
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+#include "types.h"
+#include "config.h"
+
+#define KEYBOARD_DATA_PORT 0x60
+#define KEYBOARD_STATUS_PORT 0x64
+#define KEYBOARD_STATUS_OUTPUT_FULL 0x01
+
+/**
+ * Single-producer/single-consumer ring of bytes, head and tail run freely and are masked on access
+ * Only the producer writes head and only the consumer writes tail, so neither needs a lock
+ */
+struct byte_ring
+{
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint8_t data[KEYBOARD_RING_SIZE];
+};
+
+/**
+ * @param scancodes uint32_t - Scancodes taken from the controller
+ * @param dropped uint32_t - Scancodes or characters lost because a ring was full
+ */
+struct keyboard_stats
+{
+    uint32_t scancodes;
+    uint32_t dropped;
+};
+
+void keyboard_init();
+int keyboard_read(char* buf, int len);
+char keyboard_getchar();
+struct keyboard_stats* keyboard_get_stats();
+
+#endif
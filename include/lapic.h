@@ -0,0 +1,54 @@
+#ifndef LAPIC_H
+#define LAPIC_H
+
+#include "types.h"
+
+struct trap_frame;
+
+// Register offsets of the local APIC, Reference: https://wiki.osdev.org/APIC
+#define LAPIC_ID 0x20
+#define LAPIC_VERSION 0x30
+#define LAPIC_TPR 0x80
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0
+#define LAPIC_ESR 0x280
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_DEFAULT_BASE 0xFEE00000
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+// Vectors of the local timer and of spurious interrupts, above the 16 ISA IRQs at 0x20-0x2F
+#define LAPIC_TIMER_VECTOR 0x30
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+// Delivery mode and level bits of the low ICR word
+#define LAPIC_ICR_INIT 0x00000500
+#define LAPIC_ICR_STARTUP 0x00000600
+#define LAPIC_ICR_PENDING 0x00001000
+#define LAPIC_ICR_ASSERT 0x00004000
+#define LAPIC_ICR_LEVEL 0x00008000
+
+void lapic_init(uint32_t base);
+void lapic_enable();
+bool lapic_present();
+uint32_t lapic_read(uint32_t reg);
+void lapic_write(uint32_t reg, uint32_t value);
+uint8_t lapic_id();
+void lapic_send_ipi(uint8_t apic_id, uint32_t icr);
+void lapic_eoi();
+void lapic_timer_calibrate();
+bool lapic_timer_calibrated();
+void lapic_timer_start();
+void lapic_timer_handler(struct trap_frame* frame);
+
+#endif
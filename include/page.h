@@ -72,6 +72,7 @@ struct page_directory* create_page_directory(uint8_t flags);
  
 
 int set_paging(uint32_t* directory, void* virtual_addr, uint32_t val);
+uint32_t get_paging(uint32_t* directory, void* virtual_addr);
 bool is_page_aligned(void* addr);
 
 // We do not call enable_paging()
@@ -79,5 +80,6 @@ bool is_page_aligned(void* addr);
 // and switch to that directory
 void enable_paging();
 void load_page_directory(uint32_t* directory);
+void invalidate_page(void* virtual_addr);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include "types.h"
+
+struct disk;
+
+// file_id of a page that no longer belongs to a file but is still mapped
+#define PAGE_CACHE_NO_FILE 0xFFFFFFFFFFFFFFFFULL
+
+/**
+ * A cached page of file data, the bytes past the end of the file are zero
+ * @param disk struct disk* - The disk of the file
+ * @param file_id uint64_t - Identifies the file on its disk, chosen by the filesystem(e.g. a byte address)
+ * @param index uint32_t - The page index within the file
+ * @param refcount int - Holds(mappings) on the page, a held page is never evicted
+ * @param data void* - PAGE_SIZE bytes, page aligned
+ */
+struct page_cache_page
+{
+    struct disk* disk;
+    uint64_t file_id;
+    uint32_t index;
+    int refcount;
+    bool used;
+    void* data;
+
+    struct page_cache_page* hash_next;
+    struct page_cache_page* lru_prev;
+    struct page_cache_page* lru_next;
+};
+
+int page_cache_init();
+struct page_cache_page* page_cache_lookup(struct disk* disk, uint64_t file_id, uint32_t index);
+struct page_cache_page* page_cache_get(struct disk* disk, uint64_t file_id, uint32_t index);
+struct page_cache_page* page_cache_alloc(struct disk* disk, uint64_t file_id, uint32_t index);
+void page_cache_drop(struct page_cache_page* page);
+void page_cache_hold(struct page_cache_page* page);
+void page_cache_release(struct page_cache_page* page);
+struct page_cache_page* page_cache_from_address(void* data);
+void page_cache_update(struct disk* disk, uint64_t file_id, uint32_t offset, const void* buf, uint32_t len);
+void page_cache_truncate(struct disk* disk, uint64_t file_id, uint32_t size);
+void page_cache_drop_disk(struct disk* disk);
+
+#endif
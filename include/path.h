@@ -2,19 +2,33 @@
 # define PATH_H
 
 #define MAX_PATH_LEN 128
+#define MAX_PATH_PARTS 16
 
-struct path_root{
-    int drive_no;
-    struct path_part* first_part;
-};
-
+/**
+ * A path component, a span of the original path string
+ * @param part Points into the parsed string, it is not NUL terminated
+ * @param len The length of the component
+ * @param next The next component, 0 for the last one
+ */
 struct path_part
 {
     const char* part;
+    int len;
     struct path_part* next;
 };
 
-struct path_root* parse(const char* path);
-void free_path(struct path_root* root);
+/**
+ * A parsed path, filled in by parse() without any heap allocation
+ * The parts point into the parsed string, so it must outlive the path_root
+ * @param first_part The first component, 0 for the root directory
+ */
+struct path_root{
+    int drive_no;
+    struct path_part* first_part;
+    int total_parts;
+    struct path_part parts[MAX_PATH_PARTS];
+};
+
+int parse(const char* path, struct path_root* root);
 
-# endif
\ No newline at end of file
+# endif
@@ -0,0 +1,90 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "types.h"
+#include "config.h"
+#include "gdt.h"
+#include "tss.h"
+#include "thread.h"
+#include "softirq.h"
+
+/**
+ * What the firmware tables report about the CPUs and interrupt controllers
+ * @param lapic_address uint32_t - Physical address of the local APIC registers
+ * @param ioapic_address uint32_t - Physical address of the first IOAPIC, 0 if none was found
+ * @param ioapic_id uint8_t - APIC id of that IOAPIC
+ * @param ioapic_gsi_base uint32_t - Global system interrupt of the first pin of that IOAPIC
+ * @param total_cpus int - Enabled processors, their APIC ids are in apic_ids
+ * @param irq_gsi uint32_t[] - Global system interrupt of every ISA IRQ, the same number unless the firmware overrides it
+ * @param irq_flags uint16_t[] - MPS INTI flags(polarity and trigger mode) of every ISA IRQ
+ */
+#define ISA_IRQS 16
+
+struct smp_config
+{
+    uint32_t lapic_address;
+    uint32_t ioapic_address;
+    uint8_t ioapic_id;
+    uint32_t ioapic_gsi_base;
+    int total_cpus;
+    uint8_t apic_ids[MAX_CPUS];
+    uint32_t irq_gsi[ISA_IRQS];
+    uint16_t irq_flags[ISA_IRQS];
+};
+
+/**
+ * State of one CPU, the PERCPU_SELECTOR segment(%gs) of the CPU starts at its struct cpu
+ * @param self struct cpu* - Points to the struct itself, this_cpu() reads it from %gs:0
+ * @param id int - Logical CPU number, the BSP is 0
+ * @param apic_id uint8_t - Id of the local APIC of the CPU, IPIs are sent to it
+ * @param online bool - Set by the CPU once it runs kernel code on its own GDT and stack
+ * @param stack void* - Boot stack of an AP, 0 for the BSP
+ * @param current struct thread* - The thread running on the CPU
+ * @param idle struct thread* - Runs when there is no thread to run or steal, never queued
+ * @param has_timer bool - Whether a timer interrupt reaches the CPU, the idle thread only halts then
+ * @param requeue struct thread* - Thread switched out and still ready, queued once the switch is done
+ * @param dead struct thread* - Thread that exited, freed once the switch is done
+ * @param sleep_lock struct spinlock* - Lock of the wait queue the switched out thread sleeps on, released once the switch is done
+ * @param work_head struct work* - Work queued by interrupt handlers on the CPU, oldest first
+ * @param in_softirq bool - The CPU is running queued work, the scheduler does not preempt it meanwhile
+ */
+struct cpu
+{
+    struct cpu* self;
+    int id;
+    uint8_t apic_id;
+    volatile bool online;
+    void* stack;
+    struct thread* current;
+    struct thread* idle;
+    bool has_timer;
+    struct thread* requeue;
+    struct thread* dead;
+    struct spinlock* sleep_lock;
+    struct work* work_head;
+    struct work* work_tail;
+    bool in_softirq;
+    struct run_queue run_queue;
+    struct sched_stats stats;
+    struct tss tss;
+    struct gdt_entry gdt[TOTAL_GDT_SEGMENTS];
+};
+
+static inline struct cpu* __attribute__((always_inline)) this_cpu()
+{
+    struct cpu* cpu;
+    asm volatile("movl %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+void smp_init_bsp();
+void smp_init();
+int smp_total_cpus();
+struct cpu* smp_get_cpu(int id);
+int irq_set_affinity(int irq, int cpu_id);
+
+// cpu/acpi.c
+int acpi_read_madt(struct smp_config* config);
+int mp_read_table(struct smp_config* config);
+
+#endif
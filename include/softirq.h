@@ -0,0 +1,25 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include "types.h"
+
+typedef void (*WORK_FUNCTION)(void* arg);
+
+/**
+ * Work deferred by an interrupt handler, it runs on the same CPU with interrupts enabled once the handler returns
+ * The work function must not sleep or yield, the interrupted thread is not preempted while it runs
+ * @param pending uint32_t - Set while queued, queueing it again before it runs does nothing
+ */
+struct work
+{
+    WORK_FUNCTION function;
+    void* arg;
+    volatile uint32_t pending;
+    struct work* next;
+};
+
+void work_init(struct work* work, WORK_FUNCTION function, void* arg);
+bool work_queue(struct work* work);
+void softirq_run();
+
+#endif
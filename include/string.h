@@ -13,8 +13,10 @@ char* strcat(char* dest, const char* src);
 bool isnum(char c);
 int ctoi(char c);
 char tolower(char c);
+char toupper(char c);
 int strcmp_prefix(const char* str1, const char* str2, size_t n);
 int strcmp_prefix_ignore_case(const char* str1, const char* str2, size_t n);
+int strcmp_ignore_case(const char* str1, const char* str2);
 //若count输入负数将会导致复制次数错误。
 void* memcpy(void* dest, const void* src, size_t count);
 void* memset(void* str, int c, size_t n);
@@ -0,0 +1,129 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "types.h"
+#include "config.h"
+#include "atomic.h"
+
+#define THREAD_NAME_LEN 16
+
+enum thread_state
+{
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_DEAD,
+};
+
+typedef void (*THREAD_FUNCTION)(void* arg);
+
+/**
+ * A kernel thread
+ * @param esp uint32_t - Saved stack pointer while the thread is switched out, must stay the first member(task/switch.S)
+ * @param id int - Thread id, the boot thread is 0
+ * @param state enum thread_state - THREAD_RUNNING while a CPU runs it
+ * @param stack void* - Bottom of the kernel stack from kmalloc(), 0 for the boot thread
+ * @param stack_top uint32_t - Loaded into tss.esp0 while the thread runs
+ * @param ticks_left uint32_t - Timer ticks left of the time slice
+ * @param wait_next struct thread* - Next thread sleeping on the same wait queue
+ * A ready thread sits in the run queue of one CPU and may be stolen by another one
+ */
+struct thread
+{
+    uint32_t esp;
+    int id;
+    enum thread_state state;
+    void* stack;
+    uint32_t stack_top;
+    uint32_t ticks_left;
+    struct thread* wait_next;
+    THREAD_FUNCTION function;
+    void* arg;
+    char name[THREAD_NAME_LEN];
+};
+
+/**
+ * Ready threads of one CPU, a Chase-Lev work-stealing deque in a fixed ring
+ * Only the owning CPU pushes at bottom, with interrupts disabled. Every CPU takes from top with a cmpxchg,
+ * the owner included, so a CPU runs its threads round-robin and idle CPUs steal the oldest ones
+ */
+struct run_queue
+{
+    volatile uint32_t top;
+    volatile uint32_t bottom;
+    struct thread* volatile slots[RUN_QUEUE_SIZE];
+};
+
+/**
+ * Scheduler counters of one CPU
+ * @param switches uint32_t - Context switches on the CPU
+ * @param steals uint32_t - Threads the CPU took from the run queue of another CPU
+ * @param max_queued uint32_t - Longest its run queue has been
+ */
+struct sched_stats
+{
+    uint32_t switches;
+    uint32_t steals;
+    uint32_t max_queued;
+};
+
+/**
+ * Threads sleeping until a condition holds, oldest first
+ * The lock is only taken with interrupts disabled, so interrupt handlers can call wake_up()
+ */
+struct wait_queue
+{
+    struct spinlock lock;
+    struct thread* head;
+    struct thread* tail;
+};
+
+/**
+ * Sleep until condition is true, it is evaluated with the queue locked and interrupts disabled
+ * Whoever makes it true calls wake_up() afterwards, it takes the same lock so the wakeup can not be missed
+ */
+#define wait_event(queue, condition) \
+    do \
+    { \
+        uint32_t __flags = wait_queue_lock(queue); \
+        while(!(condition)) \
+        { \
+            wait_queue_sleep_locked(queue); \
+        } \
+        wait_queue_unlock(queue, __flags); \
+    } while(0)
+
+/**
+ * A lock that puts the threads waiting for it to sleep, the holder may sleep on I/O
+ */
+struct mutex
+{
+    volatile uint32_t locked;
+    struct thread* owner;
+    struct wait_queue waiters;
+};
+
+void thread_init();
+void thread_init_ap();
+int thread_create(THREAD_FUNCTION function, void* arg, const char* name);
+struct thread* current_thread();
+void thread_yield();
+void thread_exit();
+uint32_t run_queue_length(struct run_queue* queue);
+void print_sched_stats();
+
+void wait_queue_init(struct wait_queue* queue);
+uint32_t wait_queue_lock(struct wait_queue* queue);
+void wait_queue_unlock(struct wait_queue* queue, uint32_t flags);
+void wait_queue_sleep_locked(struct wait_queue* queue);
+void wake_up_locked(struct wait_queue* queue);
+void wake_up(struct wait_queue* queue);
+
+void mutex_init(struct mutex* mutex);
+void mutex_lock(struct mutex* mutex);
+void mutex_unlock(struct mutex* mutex);
+
+// task/switch.S
+void switch_context(uint32_t* old_esp, uint32_t new_esp);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include "vfs.h"
+
+struct filesystem;
+
+struct filesystem* init_tmpfs();
+int resolve_tmpfs(struct disk* disk);
+#endif // TMPFS_H
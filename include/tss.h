@@ -32,4 +32,5 @@ struct tss
 } __attribute__((packed));
 
 void load_tss(int tss_segment);
+void tss_set_kernel_stack(uint32_t esp0);
 #endif 
\ No newline at end of file
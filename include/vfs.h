@@ -23,7 +23,15 @@ enum
 
 enum
 {
-    FILE_STAT_READ_ONLY = 0b00000001
+    FILE_STAT_READ_ONLY = 0b00000001,
+    FILE_STAT_DIRECTORY = 0b00000010
+};
+
+typedef unsigned int FILE_DESCRIPTOR_TYPE;
+enum
+{
+    FILE_DESCRIPTOR_FILE,
+    FILE_DESCRIPTOR_DIRECTORY
 };
 
 typedef unsigned int FILE_STAT_FLAGS;
@@ -32,7 +40,14 @@ struct disk;
 typedef void*(*FS_OPEN_FILE)(struct disk* disk, struct path_part* path, FILE_OPEN_MODE mode);
 typedef int (*FS_RESOLVE_FUNC)(struct disk* disk);
 typedef int (*FS_READ_FILE)(struct disk* disk, void* data, uint32_t size, uint32_t count, char* out);
+typedef int (*FS_WRITE_FILE)(struct disk* disk, void* data, uint32_t size, uint32_t count, const char* in);
+typedef int (*FS_TRUNCATE_FUNCTION)(struct disk* disk, void* private, uint32_t size);
+typedef int (*FS_ALLOCATE_FUNCTION)(struct disk* disk, void* private, uint32_t size);
+typedef int (*FS_FLUSH_FUNCTION)(struct disk* disk, void* private);
+typedef int (*FS_UNLINK_FUNCTION)(struct disk* disk, struct path_part* path);
+typedef int (*FS_MKDIR_FUNCTION)(struct disk* disk, struct path_part* path);
 typedef int (*FS_CLOSE_FUNCTION)(void* private);
+typedef int (*FS_UNMOUNT_FUNCTION)(struct disk* disk);
 
 struct file_stat
 {
@@ -42,6 +57,34 @@ struct file_stat
 
 typedef int (*FS_STAT_FUNCTION)(struct disk* disk, void* private, struct file_stat* stat);
 
+// A directory entry returned by readdir
+struct dirent
+{
+    char name[16]; // 8.3 name with the dot and the terminator
+    uint32_t size;
+    FILE_STAT_FLAGS flags;
+};
+
+// One buffer of a vectored read or write
+struct iovec
+{
+    void* base;
+    uint32_t len;
+};
+
+typedef int (*FS_READV)(struct disk* disk, void* private, const struct iovec* iov, int iovcnt);
+typedef int (*FS_WRITEV)(struct disk* disk, void* private, const struct iovec* iov, int iovcnt);
+
+// Copy len bytes from the current offset of in to the current offset of out, both on disk
+typedef int (*FS_COPY_RANGE)(struct disk* disk, void* in, void* out, uint32_t len);
+
+// Hold a page of file data for a mapping, the page is released through the page cache
+typedef int (*FS_MAP_PAGE)(struct disk* disk, void* private, uint32_t index, void** page);
+
+typedef void*(*FS_OPEN_DIR)(struct disk* disk, struct path_part* path);
+typedef int (*FS_READ_DIR)(struct disk* disk, void* private, struct dirent* dirent);
+typedef int (*FS_CLOSE_DIR)(void* private);
+
 struct filesystem
 {
     // Filesystem resolve should return zero if the disk is using the filesystem
@@ -51,22 +94,56 @@ struct filesystem
     FS_RESOLVE_FUNC resolve;
     FS_STAT_FUNCTION stat;
 
+    // Optional, a read-only filesystem leaves them null
+    FS_WRITE_FILE write_file;
+    FS_TRUNCATE_FUNCTION truncate;
+    FS_ALLOCATE_FUNCTION allocate;
+    FS_FLUSH_FUNCTION flush;
+    FS_UNLINK_FUNCTION unlink;
+    FS_MKDIR_FUNCTION mkdir;
+
+    // Optional, directory iteration
+    FS_OPEN_DIR open_dir;
+    FS_READ_DIR read_dir;
+    FS_CLOSE_DIR close_dir;
+
+    // Optional, scatter/gather I/O, the VFS falls back to one call per buffer
+    FS_READV readv;
+    FS_WRITEV writev;
+
+    // Optional, needed by mmap
+    FS_MAP_PAGE map_page;
+
+    // Optional, writes back and frees the state of a volume, without it the state stays for the next mount
+    FS_UNMOUNT_FUNCTION unmount;
+
+    // Optional, copies between two files of the filesystem, the VFS falls back to read and write
+    FS_COPY_RANGE copy_range;
+
     // Name the filesystem
     char name[20];
 };
 
 /**
- * File descriptor structure
- * @param index The file descriptor index
+ * File descriptor structure, a slot of the preallocated descriptor table
+ * @param index The file descriptor number handed out, 0 while the slot is free
+ * @param generation Bumped every time the slot is freed, so a stale number no longer matches index
+ * @param next_free The next slot of the free list while the slot is free, -1 for the last one
  * @param fs The filesystem that the file descriptor is using
  * @param data The private data for the file descriptor(points to the filesystem's file descriptor, which contains fat item and r/w pointer location)
  * @param disk The disk that the file descriptor is using
+ * @param mode The mode the file was opened in
+ * @param type Whether the descriptor is an open file or an open directory
  */
 struct file_descriptor
 {
     // File descriptor index
     int index;
+    int generation;
+    int next_free;
     struct filesystem* fs;
+    FILE_OPEN_MODE mode;
+    FILE_DESCRIPTOR_TYPE type;
     
     // Private data for internal file descriptor
     void* data;
@@ -78,9 +155,41 @@ struct file_descriptor
 void init_fs();
 int fopen(const char* filename, const char* mode);
 int fread(void* ptr, uint32_t size, uint32_t count, int fd);
+int fwrite(const void* ptr, uint32_t size, uint32_t count, int fd);
+int freadv(int fd, const struct iovec* iov, int iovcnt);
+int fwritev(int fd, const struct iovec* iov, int iovcnt);
 int fstat(int fd, struct file_stat* stat);
+int ftruncate(int fd, uint32_t size);
+int fallocate(int fd, uint32_t size);
+int fsync(int fd);
+int unlink(const char* filename);
+int mkdir(const char* path);
+
+int opendir(const char* path);
+int readdir(int dd, struct dirent* dirent);
+int closedir(int dd);
 
 int fclose(int fd);
+int copy_file_range(int fd_in, int fd_out, uint32_t len);
+int mmap(int fd, uint32_t offset, uint32_t length, uint32_t* directory, void* virtual_addr);
+int munmap(uint32_t* directory, void* virtual_addr, uint32_t length);
+/**
+ * A mounted filesystem, paths reach it by their drive number and leading parts
+ * @param used Whether the slot is in use
+ * @param target The mount point, e.g. "0:/" or "0:/mnt", the parts of root point into it
+ * @param root The parsed mount point
+ * @param disk The mounted disk, its filesystem was resolved once when it was mounted
+ */
+struct mount
+{
+    bool used;
+    char target[MAX_PATH_LEN + 1];
+    struct path_root root;
+    struct disk* disk;
+};
+
+int mount(int disk_id, const char* target);
+int umount(const char* target);
 void insert_filesystem(struct filesystem* fs);
 struct filesystem* resolve_fs(struct disk* disk);
 
@@ -0,0 +1,33 @@
+#ifndef VNODE_H
+#define VNODE_H
+
+#include "types.h"
+
+struct disk;
+
+/**
+ * An open file, shared by every descriptor that has the file open
+ * @param disk struct disk* - The disk of the file
+ * @param id uint64_t - Identifies the file on its disk, chosen by the filesystem
+ * @param refs int - Descriptors holding the vnode, the slot is freed when the last one puts it
+ * @param data void* - The filesystem state of the file, e.g. its directory entry
+ * @param hashed bool - Whether vnode_get() finds the vnode, an unlinked file is only reachable through its descriptors
+ */
+struct vnode
+{
+    struct disk* disk;
+    uint64_t id;
+    int refs;
+    void* data;
+    bool hashed;
+
+    struct vnode* hash_next; // Next vnode of the bucket, or of the free list while the slot is free
+};
+
+void init_vnodes();
+struct vnode* vnode_get(struct disk* disk, uint64_t id);
+struct vnode* vnode_create(struct disk* disk, uint64_t id, void* data);
+void vnode_unhash(struct vnode* vnode);
+int vnode_put(struct vnode* vnode);
+
+#endif
@@ -0,0 +1,107 @@
+#include "interrupt.h"
+#include "print.h"
+
+// Reference: Intel SDM Vol. 3A, 6.15 Exception and Interrupt Reference
+static const char* exception_names[EXCEPTION_VECTORS] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow", "BOUND range exceeded",
+    "Invalid opcode", "Device not available", "Double fault", "Coprocessor segment overrun",
+    "Invalid TSS", "Segment not present", "Stack-segment fault", "General protection fault",
+    "Page fault", "Reserved", "x87 floating-point error", "Alignment check", "Machine check",
+    "SIMD floating-point error", "Virtualization exception", "Control protection exception",
+    "Reserved", "Reserved", "Reserved", "Reserved", "Reserved", "Reserved",
+    "Hypervisor injection exception", "VMM communication exception", "Security exception", "Reserved",
+};
+
+// Page fault error code bits
+#define PF_PRESENT 0x1
+#define PF_WRITE 0x2
+#define PF_USER 0x4
+
+static void print_frame(struct trap_frame* frame)
+{
+    print("eip: ");
+    put_hex(frame->eip);
+    print(" cs: ");
+    put_hex(frame->cs);
+    print(" eflags: ");
+    put_hex(frame->eflags);
+    print(" error: ");
+    put_hex(frame->error_code);
+    print("\neax: ");
+    put_hex(frame->eax);
+    print(" ebx: ");
+    put_hex(frame->ebx);
+    print(" ecx: ");
+    put_hex(frame->ecx);
+    print(" edx: ");
+    put_hex(frame->edx);
+    print("\nesi: ");
+    put_hex(frame->esi);
+    print(" edi: ");
+    put_hex(frame->edi);
+    print(" ebp: ");
+    put_hex(frame->ebp);
+    print(" esp: ");
+    put_hex(frame->kernel_esp + 20); // Above the vector, error code, eip, cs and eflags
+    print("\n");
+}
+
+static void fatal_exception(struct trap_frame* frame)
+{
+    print("\nException ");
+    put_uint(frame->vector);
+    print(": ");
+    print(exception_names[frame->vector]);
+    print("\n");
+    print_frame(frame);
+    panic("Unhandled exception\n");
+}
+
+static void divide_error_handler(struct trap_frame* frame)
+{
+    print("\nDivide by zero");
+    fatal_exception(frame);
+}
+
+/**
+ * @brief #GP, a non-zero error code is the selector(index, TI, EXT) that caused it
+ */
+static void general_protection_handler(struct trap_frame* frame)
+{
+    if (frame->error_code) {
+        print("\nGeneral protection fault on selector ");
+        put_hex(frame->error_code & ~0x7);
+        print(frame->error_code & 0x2 ? " (IDT)" : (frame->error_code & 0x4 ? " (LDT)" : " (GDT)"));
+    }
+    fatal_exception(frame);
+}
+
+/**
+ * @brief #PF, cr2 holds the address that faulted
+ */
+static void page_fault_handler(struct trap_frame* frame)
+{
+    uint32_t address;
+    asm volatile("movl %%cr2, %0" : "=r"(address));
+
+    print("\nPage fault at ");
+    put_hex(address);
+    print(frame->error_code & PF_USER ? ", user " : ", kernel ");
+    print(frame->error_code & PF_WRITE ? "write, " : "read, ");
+    print(frame->error_code & PF_PRESENT ? "protection violation" : "page not present");
+    fatal_exception(frame);
+}
+
+/**
+ * @brief Register a handler for every CPU exception, the unexpected ones print the trap frame and panic
+ */
+void exception_init()
+{
+    for (int vector = 0; vector < EXCEPTION_VECTORS; vector++) {
+        interrupt_register(vector, fatal_exception);
+    }
+
+    interrupt_register(DIVIDE_ERROR_VECTOR, divide_error_handler);
+    interrupt_register(GENERAL_PROTECTION_VECTOR, general_protection_handler);
+    interrupt_register(PAGE_FAULT_VECTOR, page_fault_handler);
+}
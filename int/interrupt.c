@@ -1,36 +1,197 @@
-
 #include"string.h"
 #include "io.h"
 #include "desc.h"
 #include "print.h"
+#include "clock.h"
+#include "lapic.h"
+#include "errno.h"
+#include "config.h"
+#include "interrupt.h"
+#include "smp.h"
+#include "softirq.h"
 
-struct gatedesc idt[256];
+struct gatedesc idt[TOTAL_VECTORS];
 
-void int21h();
-void ignore_int();
+extern char interrupt_stubs[]; // int/int.S
 
-void int21h_handler() {
-    print("Keyboard pressed!\n");
-    outb(0xa0, 0x20);
+static INTERRUPT_HANDLER handlers[TOTAL_VECTORS];
+static bool apic_mode; // The IOAPIC and the local APICs deliver the IRQs, the 8259s are masked
+static bool timing; // rdtsc is only there with a TSC
+static struct interrupt_stats stats[MAX_CPUS][TOTAL_VECTORS]; // Only written by their CPU with interrupts disabled
+
+/**
+ * @brief End an IRQ: one write to the local APIC, or the 8259 EOI, to the slave only when the IRQ came through it
+ */
+void irq_eoi(int irq) {
+    if (apic_mode) {
+        lapic_eoi();
+        return;
+    }
+
+    if (irq >= 8) {
+        outb(0xa0, 0x20);
+    }
     outb(0x20, 0x20);
 }
 
-void ignore_int_handler() {
+// Send the EOIs to the local APIC from now on, call once the IOAPIC routes the IRQs
+void irq_use_apic() {
+    apic_mode = true;
+}
+
+// Mask every IRQ of both 8259s, they stay programmed at 0x20-0x2F so a stray IRQ does not look like an exception
+void pic_disable() {
+    outb(0xa1, 0xff);
+    outb(0x21, 0xff);
+}
+
+// Spurious interrupts of the local APIC must not get an EOI
+static void spurious_handler(struct trap_frame* frame) {
+}
+
+/**
+ * @brief Set the handler of a vector, it runs with interrupts disabled and sends its own EOI
+ * @return 0 if success, -EINVARG if the vector does not exist
+ */
+int interrupt_register(int vector, INTERRUPT_HANDLER handler) {
+    if (vector < 0 || vector >= TOTAL_VECTORS) {
+        return -EINVARG;
+    }
+
+    handlers[vector] = handler;
+    return 0;
+}
+
+static void run_handler(struct trap_frame* frame) {
+    INTERRUPT_HANDLER handler = handlers[frame->vector];
+    if (handler) {
+        handler(frame);
+        return;
+    }
+
+    if (frame->vector < EXCEPTION_VECTORS) {
+        return; // exception_init() registers every exception
+    }
+
+    if (apic_mode) {
+        lapic_eoi();
+        return;
+    }
+
     outb(0xa0, 0x20);
     outb(0x20, 0x20);
 }
 
-void idt_init() {
-    memset(idt, 0, sizeof(idt));
-    for (int i = 0; i < sizeof(idt)/sizeof(idt[0]); ++i) {
-        set_int(idt[i], 0x8,ignore_int,3);
+/**
+ * @brief Called by every stub in int/int.S, run the handler of the vector, then the work it deferred, and account their time
+ * Exceptions without a handler go to the default exception handler, other vectors just get an EOI
+ */
+void interrupt_dispatch(struct trap_frame* frame) {
+    struct cpu* cpu = this_cpu();
+    struct interrupt_stats* stat = &stats[cpu->id][frame->vector];
+    stat->count ++;
+
+    uint32_t switches = cpu->stats.switches;
+    uint64_t start = timing ? read_tsc() : 0;
+    run_handler(frame);
+    uint64_t handled = timing ? read_tsc() : 0;
+
+    // Deferred work enables interrupts, only do that if the interrupted code had them enabled
+    if (frame->eflags & EFLAGS_IF) {
+        softirq_run();
+    }
+
+    if (!timing) {
+        return;
+    }
+
+    // A handler that switched threads returns much later, maybe on another CPU
+    uint64_t end = read_tsc();
+    if (this_cpu() != cpu || cpu->stats.switches != switches) {
+        stat->switched ++;
+        return;
     }
 
-    set_int(idt[0x21], 0x8,int21h,0);
+    uint32_t cycles = end - start;
+    uint32_t irq_off_cycles = handled - start;
+    stat->cycles += cycles;
+    stat->max_cycles = cycles > stat->max_cycles ? cycles : stat->max_cycles;
+    stat->irq_off_cycles += irq_off_cycles;
+    stat->max_irq_off_cycles = irq_off_cycles > stat->max_irq_off_cycles ? irq_off_cycles : stat->max_irq_off_cycles;
+}
+
+static void put_ns(uint64_t cycles) {
+    put_uint((uint32_t)clock_cycles_to_ns(cycles));
+    print("ns");
+}
+
+/**
+ * @brief Print the vectors that fired with their counts and times summed over all CPUs
+ * The times are averages and maxima per run, in ns
+ */
+void print_interrupt_stats() {
+    print("vector count switched avg max irq-off-avg irq-off-max\n");
+    for (int vector = 0; vector < TOTAL_VECTORS; ++vector) {
+        struct interrupt_stats total;
+        memset(&total, 0, sizeof(total));
+        for (int i = 0; i < smp_total_cpus(); ++i) {
+            struct interrupt_stats* stat = &stats[i][vector];
+            total.count += stat->count;
+            total.switched += stat->switched;
+            total.cycles += stat->cycles;
+            total.max_cycles = stat->max_cycles > total.max_cycles ? stat->max_cycles : total.max_cycles;
+            total.irq_off_cycles += stat->irq_off_cycles;
+            total.max_irq_off_cycles = stat->max_irq_off_cycles > total.max_irq_off_cycles ? stat->max_irq_off_cycles : total.max_irq_off_cycles;
+        }
+
+        if (!total.count) {
+            continue;
+        }
 
+        uint32_t timed = total.count - total.switched;
+        put_hex(vector);
+        print(" ");
+        put_uint(total.count);
+        print(" ");
+        put_uint(total.switched);
+        print(" ");
+        // Every timed run adds less than 2^32 cycles, so the averages fit 32 bits
+        put_ns(timed ? div64_32(total.cycles, timed) : 0);
+        print(" ");
+        put_ns(total.max_cycles);
+        print(" ");
+        put_ns(timed ? div64_32(total.irq_off_cycles, timed) : 0);
+        print(" ");
+        put_ns(total.max_irq_off_cycles);
+        print("\n");
+    }
+}
+
+// Load the shared IDT on the calling CPU
+void idt_load() {
     // 设置idt_ptr
     uint64_t idt_ptr=((uint64_t)((uint32_t)(&idt))<<16)+sizeof idt - 1;
     asm volatile("lidt %0"::"m"(idt_ptr));
+}
+
+void idt_init() {
+    apic_mode = false;
+    timing = clock_tsc_khz() != 0; // clock_init() ran first
+    memset(idt, 0, sizeof(idt));
+    memset(handlers, 0, sizeof(handlers));
+    memset(stats, 0, sizeof(stats));
+
+    // Interrupt gates: the CPU clears IF on entry, so no interrupt can slip in before the handler runs
+    for (int i = 0; i < TOTAL_VECTORS; ++i) {
+        set_gate(idt[i], 0, 0x8, interrupt_stubs + i * INTERRUPT_STUB_SIZE, 0);
+    }
+
+    exception_init();
+    interrupt_register(TIMER_VECTOR, timer_interrupt_handler);
+    interrupt_register(LAPIC_TIMER_VECTOR, lapic_timer_handler);
+    interrupt_register(LAPIC_SPURIOUS_VECTOR, spurious_handler);
+
+    idt_load();
     //开启中断
     asm volatile("sti");
 }
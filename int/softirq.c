@@ -0,0 +1,70 @@
+#include "softirq.h"
+#include "smp.h"
+#include "atomic.h"
+#include "io.h"
+
+void work_init(struct work* work, WORK_FUNCTION function, void* arg)
+{
+    work->function = function;
+    work->arg = arg;
+    work->pending = 0;
+    work->next = 0;
+}
+
+/**
+ * @brief Queue work on the calling CPU, the top half of a handler only acknowledges the device and queues the rest
+ * @return true if queued, false if it was still pending
+ */
+bool work_queue(struct work* work)
+{
+    if(atomic_xchg(&work->pending, 1))
+    {
+        return false;
+    }
+
+    uint32_t flags = irq_save();
+    struct cpu* cpu = this_cpu();
+    work->next = 0;
+    if(cpu->work_tail)
+    {
+        cpu->work_tail->next = work;
+    }
+    else
+    {
+        cpu->work_head = work;
+    }
+    cpu->work_tail = work;
+    irq_restore(flags);
+    return true;
+}
+
+/**
+ * @brief Run the work queued on this CPU with interrupts enabled
+ * Called with interrupts disabled at the end of interrupt_dispatch(), when the interrupted code had them enabled.
+ * Interrupts that arrive meanwhile only queue more work, this loop runs it, so the stack does not grow
+ */
+void softirq_run()
+{
+    struct cpu* cpu = this_cpu();
+    if(cpu->in_softirq || !cpu->work_head)
+    {
+        return;
+    }
+
+    cpu->in_softirq = true;
+    while(cpu->work_head)
+    {
+        struct work* work = cpu->work_head;
+        cpu->work_head = work->next;
+        if(!cpu->work_head)
+        {
+            cpu->work_tail = 0;
+        }
+        work->pending = 0; // It may be queued again while it runs
+
+        asm volatile("sti");
+        work->function(work->arg);
+        asm volatile("cli");
+    }
+    cpu->in_softirq = false;
+}
@@ -0,0 +1,225 @@
+#include "keyboard.h"
+#include "interrupt.h"
+#include "softirq.h"
+#include "thread.h"
+#include "atomic.h"
+#include "io.h"
+#include "print.h"
+
+// Reference: https://wiki.osdev.org/PS/2_Keyboard, scancode set 1
+#define SCANCODE_RELEASE 0x80
+#define SCANCODE_EXTENDED 0xE0
+#define SCANCODE_LEFT_SHIFT 0x2A
+#define SCANCODE_RIGHT_SHIFT 0x36
+#define SCANCODE_CTRL 0x1D
+#define SCANCODE_CAPS_LOCK 0x3A
+
+static const char keymap[] = {
+    0, 27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
+    '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
+    0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`',
+    0, '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0,
+    '*', 0, ' ',
+};
+
+static const char keymap_shift[] = {
+    0, 27, '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', '\b',
+    '\t', 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', '\n',
+    0, 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~',
+    0, '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0,
+    '*', 0, ' ',
+};
+
+static struct byte_ring scancodes; // IRQ handler -> decoder
+static struct byte_ring chars; // Decoder -> readers
+static struct spinlock readers_lock; // Readers take turns as the single consumer of chars
+static struct wait_queue readers_wait; // Readers sleeping until a character is typed
+static struct work decode_work;
+static struct keyboard_stats stats;
+
+// Decoder state, only touched by decode_work which never runs twice at once
+static bool shift;
+static bool ctrl;
+static bool caps_lock;
+static bool extended;
+
+static bool ring_push(struct byte_ring* ring, uint8_t byte)
+{
+    uint32_t head = ring->head;
+    if(head - ring->tail >= KEYBOARD_RING_SIZE)
+    {
+        return false;
+    }
+
+    ring->data[head & (KEYBOARD_RING_SIZE - 1)] = byte;
+    asm volatile("" : : : "memory"); // The byte is stored before head moves, x86 keeps stores in order
+    ring->head = head + 1;
+    return true;
+}
+
+static bool ring_pop(struct byte_ring* ring, uint8_t* byte)
+{
+    uint32_t tail = ring->tail;
+    if(ring->head == tail)
+    {
+        return false;
+    }
+
+    *byte = ring->data[tail & (KEYBOARD_RING_SIZE - 1)];
+    asm volatile("" : : : "memory"); // The byte is read before the slot is given back
+    ring->tail = tail + 1;
+    return true;
+}
+
+/**
+ * @brief Turn a scancode into a character and update the modifiers
+ * @return The character, 0 for releases, modifiers and keys without one
+ */
+static char decode(uint8_t scancode)
+{
+    if(scancode == SCANCODE_EXTENDED)
+    {
+        extended = true;
+        return 0;
+    }
+
+    bool released = scancode & SCANCODE_RELEASE;
+    uint8_t key = scancode & ~SCANCODE_RELEASE;
+    if(extended)
+    {
+        extended = false;
+        if(key == SCANCODE_CTRL)
+        {
+            ctrl = !released; // Right ctrl
+        }
+        return 0; // Arrows and the other extended keys have no character
+    }
+
+    switch(key)
+    {
+        case SCANCODE_LEFT_SHIFT:
+        case SCANCODE_RIGHT_SHIFT:
+            shift = !released;
+            return 0;
+        case SCANCODE_CTRL:
+            ctrl = !released;
+            return 0;
+        case SCANCODE_CAPS_LOCK:
+            caps_lock ^= !released;
+            return 0;
+    }
+
+    if(released || key >= sizeof(keymap))
+    {
+        return 0;
+    }
+
+    char c = shift ? keymap_shift[key] : keymap[key];
+    if(caps_lock && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')))
+    {
+        c ^= 0x20;
+    }
+    if(ctrl && c)
+    {
+        c &= 0x1F; // Ctrl-A is 1
+    }
+    return c;
+}
+
+/**
+ * @brief Bottom half: decode the queued scancodes, hand the characters to the readers and echo them
+ */
+static void decode_scancodes(void* arg)
+{
+    uint8_t scancode;
+    bool typed = false;
+    while(ring_pop(&scancodes, &scancode))
+    {
+        char c = decode(scancode);
+        if(!c)
+        {
+            continue;
+        }
+
+        if(!ring_push(&chars, c))
+        {
+            stats.dropped ++;
+            continue;
+        }
+        put_char(c);
+        typed = true;
+    }
+
+    if(typed)
+    {
+        wake_up(&readers_wait);
+    }
+}
+
+/**
+ * @brief Top half: move the scancode from the controller into the ring, nothing else with interrupts off
+ */
+static void keyboard_handler(struct trap_frame* frame)
+{
+    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+    irq_eoi(KEYBOARD_IRQ);
+
+    stats.scancodes ++;
+    if(!ring_push(&scancodes, scancode))
+    {
+        stats.dropped ++;
+    }
+    work_queue(&decode_work);
+}
+
+void keyboard_init()
+{
+    scancodes.head = scancodes.tail = 0;
+    chars.head = chars.tail = 0;
+    readers_lock.locked = 0;
+    wait_queue_init(&readers_wait);
+    shift = ctrl = caps_lock = extended = false;
+    stats.scancodes = stats.dropped = 0;
+    work_init(&decode_work, decode_scancodes, 0);
+
+    // Drop what the controller buffered before the handler existed, it would not raise another IRQ otherwise
+    while(inb(KEYBOARD_STATUS_PORT) & KEYBOARD_STATUS_OUTPUT_FULL)
+    {
+        inb(KEYBOARD_DATA_PORT);
+    }
+
+    interrupt_register(IRQ_BASE_VECTOR + KEYBOARD_IRQ, keyboard_handler);
+}
+
+/**
+ * @brief Take up to len typed characters without waiting
+ * @return The characters read, 0 if there are none
+ */
+int keyboard_read(char* buf, int len)
+{
+    int total = 0;
+    uint32_t flags = irq_save();
+    spin_lock(&readers_lock);
+    while(total < len && ring_pop(&chars, (uint8_t*)&buf[total]))
+    {
+        total ++;
+    }
+    spin_unlock(&readers_lock);
+    irq_restore(flags);
+    return total;
+}
+
+/**
+ * @brief Sleep until the next typed character
+ */
+char keyboard_getchar()
+{
+    char c;
+    wait_event(&readers_wait, keyboard_read(&c, 1) == 1);
+    return c;
+}
+
+struct keyboard_stats* keyboard_get_stats()
+{
+    return &stats;
+}
@@ -143,6 +143,14 @@ void put_uint(unsigned int num) {
         }    
     }
 }
+//以0x开头的8位十六进制输出
+void put_hex(unsigned int num) {
+    put_str("0x");
+    for (int shift = 28;shift >= 0;shift -= 4) {
+        unsigned int digit = (num >> shift) & 0xf;
+        put_char(digit < 10 ? digit + '0' : digit - 10 + 'a');
+    }
+}
 void clear_screen() {
     for (int i = 0;i < VGA_WIDTH * VGA_HEIGHT;++i) {
         write_video(i, 0);
@@ -154,5 +162,5 @@ void panic(char *msg)
     print("Panic: ");
     print(msg);
     for (;;)
-        ;
+        asm volatile("cli; hlt"); // Stop the CPU instead of spinning, only an NMI wakes it
 }
\ No newline at end of file
@@ -112,23 +112,33 @@ char tolower(char c)
     return c;
 }
 
+char toupper(char c)
+{
+    if(c >= 'a' && c <= 'z')
+    {
+        return c - 32;
+    }
+    return c;
+}
+
+// Compare at most n characters, neither string has to be terminated within them
 int strcmp_prefix(const char* str1, const char* str2, size_t n)
 {
     size_t i = 0;
-    while ((str1[i] == str2[i]) && i < n) { ++i; }
-    return str1[i] - str2[i];
+    while (i < n && str1[i] && (str1[i] == str2[i])) { ++i; }
+    return i == n ? 0 : str1[i] - str2[i];
 }
 
 int strcmp_prefix_ignore_case(const char* str1, const char* str2, size_t n)
 {
     size_t i = 0;
-    while ((tolower(str1[i]) == tolower(str2[i])) && i < n) { ++i; }
-    return tolower(str1[i]) - tolower(str2[i]);
+    while (i < n && str1[i] && (tolower(str1[i]) == tolower(str2[i]))) { ++i; }
+    return i == n ? 0 : tolower(str1[i]) - tolower(str2[i]);
 }
 
 int strcmp_ignore_case(const char* str1, const char* str2)
 {
     size_t i = 0;
-    while ((tolower(str1[i]) == tolower(str2[i]))) { ++i; }
+    while (str1[i] && (tolower(str1[i]) == tolower(str2[i]))) { ++i; }
     return tolower(str1[i]) - tolower(str2[i]);
 }
@@ -3,8 +3,11 @@
 #include "config.h"
 #include "string.h"
 #include"print.h"
+#include "io.h"
+#include "atomic.h"
 struct heap kernel_heap;
 struct heap_table kernel_heap_table;
+static struct spinlock kernel_heap_lock;
 
 int heap_create(struct heap* heap, void* start, void* end, struct heap_table* table) {
     int res = 0;
@@ -31,6 +34,7 @@ int heap_create(struct heap* heap, void* start, void* end, struct heap_table* ta
 }
 
 void kheap_init() {
+    kernel_heap_lock.locked = 0;
     kernel_heap_table.entries = (heap_table_entry*)(HEAP_TABLE_ADDRESS);
     kernel_heap_table.total = HEAP_SIZE_BYTES / HEAP_BLOCK_SIZE;
 
@@ -44,7 +48,11 @@ void kheap_init() {
 
 
 void kfree(void* ptr) {
+    uint32_t flags = irq_save(); // Threads are preempted from the timer interrupt
+    spin_lock(&kernel_heap_lock); // and run on several CPUs
     heap_free(&kernel_heap, ptr);
+    spin_unlock(&kernel_heap_lock);
+    irq_restore(flags);
 }
 
 static inline int isfree(heap_table_entry entry) {
@@ -122,7 +130,12 @@ void* heap_malloc(struct heap* heap, size_t size) {
     }
 }
 void* kmalloc(size_t size) {
-    return heap_malloc(&kernel_heap, size);
+    uint32_t flags = irq_save();
+    spin_lock(&kernel_heap_lock);
+    void* ptr = heap_malloc(&kernel_heap, size);
+    spin_unlock(&kernel_heap_lock);
+    irq_restore(flags);
+    return ptr;
 }
 
 static inline int heap_address_to_block(struct heap* heap, void* address) {
@@ -82,3 +82,20 @@ int set_paging(uint32_t* directory, void* virtual_addr, uint32_t physical_addr)
     table[table_index] = physical_addr; // physical_addr is the physical address with flags set
     return res;
 }
+
+/**
+ * @brief Get the page table entry of a virtual address
+ * @return The physical address with flags, 0 if the address is not page aligned
+ */
+uint32_t get_paging(uint32_t* directory, void* virtual_addr)
+{
+    uint32_t dir_index = 0;
+    uint32_t table_index = 0;
+    if(get_page_index(virtual_addr, &dir_index, &table_index) < 0)
+    {
+        return 0;
+    }
+
+    uint32_t* table = (uint32_t*)(directory[dir_index] & 0xFFFFF000);
+    return table[table_index];
+}
@@ -0,0 +1,521 @@
+#include "thread.h"
+#include "smp.h"
+#include "tss.h"
+#include "clock.h"
+#include "config.h"
+#include "errno.h"
+#include "io.h"
+#include "atomic.h"
+#include "mm.h"
+#include "string.h"
+#include "print.h"
+
+static struct thread boot_thread; // main() becomes this thread, it runs on the boot stack
+static volatile uint32_t next_thread_id;
+static volatile uint32_t total_threads; // Threads that may be queued, at most MAX_THREADS
+
+/**
+ * @brief Queue a ready thread on the run queue of the calling CPU
+ * Only the owner pushes, with interrupts disabled, so bottom has a single writer
+ * @return 0 if success, -ENOMEM if the queue is full
+ */
+static int run_queue_push(struct run_queue* queue, struct thread* thread)
+{
+    uint32_t bottom = queue->bottom;
+    if(bottom - queue->top >= RUN_QUEUE_SIZE)
+    {
+        return -ENOMEM;
+    }
+
+    queue->slots[bottom & (RUN_QUEUE_SIZE - 1)] = thread;
+    asm volatile("" : : : "memory"); // The slot is visible before the new bottom, x86 keeps stores in order
+    queue->bottom = bottom + 1;
+    return 0;
+}
+
+/**
+ * @brief Take the oldest thread of a run queue, safe against the owner and other CPUs taking at the same time
+ * @return The thread, 0 if the queue is empty
+ */
+static struct thread* run_queue_take(struct run_queue* queue)
+{
+    for(;;)
+    {
+        uint32_t top = queue->top;
+        asm volatile("" : : : "memory"); // Read top before bottom, x86 keeps loads in order
+        uint32_t bottom = queue->bottom;
+        if((int)(bottom - top) <= 0)
+        {
+            return 0;
+        }
+
+        // The owner does not reuse the slot before top moves past it, so a failed cmpxchg only means retry
+        struct thread* thread = queue->slots[top & (RUN_QUEUE_SIZE - 1)];
+        if(atomic_cmpxchg(&queue->top, top, top + 1))
+        {
+            return thread;
+        }
+    }
+}
+
+uint32_t run_queue_length(struct run_queue* queue)
+{
+    int length = (int)(queue->bottom - queue->top);
+    return length > 0 ? length : 0;
+}
+
+/**
+ * @brief Take a thread from another CPU, the victims are tried from the next CPU on so they are spread
+ */
+static struct thread* steal_thread(struct cpu* cpu)
+{
+    int total = smp_total_cpus();
+    for(int i = 1; i < total; i++)
+    {
+        struct cpu* victim = smp_get_cpu((cpu->id + i) % total);
+        struct thread* thread = run_queue_take(&victim->run_queue);
+        if(thread)
+        {
+            cpu->stats.steals ++;
+            return thread;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Finish a switch on the new stack: queue the thread that was switched out, free the one that exited
+ * or let the one that went to sleep be woken
+ * Until now their stacks were in use, so no other CPU could be allowed to pick or free them
+ */
+static void finish_switch()
+{
+    struct cpu* cpu = this_cpu();
+    if(cpu->sleep_lock)
+    {
+        struct spinlock* lock = cpu->sleep_lock;
+        cpu->sleep_lock = 0;
+        spin_unlock(lock);
+    }
+
+    if(cpu->requeue)
+    {
+        run_queue_push(&cpu->run_queue, cpu->requeue); // Can not fail, there are at most MAX_THREADS
+        cpu->requeue = 0;
+
+        uint32_t length = run_queue_length(&cpu->run_queue);
+        cpu->stats.max_queued = length > cpu->stats.max_queued ? length : cpu->stats.max_queued;
+    }
+
+    if(cpu->dead)
+    {
+        kfree(cpu->dead->stack);
+        kfree(cpu->dead);
+        cpu->dead = 0;
+        atomic_fetch_add(&total_threads, -1);
+    }
+}
+
+/**
+ * @brief Switch to the next thread of the run queue of this CPU, or one stolen from another CPU
+ * The current thread keeps running if it still can and there is nothing else, otherwise the idle thread runs
+ * Called with interrupts disabled
+ */
+static void schedule()
+{
+    struct cpu* cpu = this_cpu();
+    struct thread* prev = cpu->current;
+    struct thread* next = run_queue_take(&cpu->run_queue);
+    if(!next)
+    {
+        next = steal_thread(cpu);
+    }
+
+    if(!next)
+    {
+        if(prev->state == THREAD_RUNNING)
+        {
+            prev->ticks_left = THREAD_TIME_SLICE;
+            return;
+        }
+        next = cpu->idle;
+    }
+
+    if(prev->state == THREAD_RUNNING && prev != cpu->idle)
+    {
+        prev->state = THREAD_READY;
+        cpu->requeue = prev;
+    }
+
+    next->state = THREAD_RUNNING;
+    next->ticks_left = THREAD_TIME_SLICE;
+    cpu->current = next;
+    cpu->stats.switches ++;
+    tss_set_kernel_stack(next->stack_top);
+    switch_context(&prev->esp, next->esp);
+
+    // prev runs again here, maybe on another CPU
+    finish_switch();
+}
+
+/**
+ * @brief Timer handler, preempt the current thread when its time slice is used up
+ * Runs in the timer interrupt after the EOI, the interrupted thread continues through its own stack when it is picked again
+ */
+static void scheduler_tick()
+{
+    struct cpu* cpu = this_cpu();
+    if(cpu->in_softirq)
+    {
+        return; // The queued work runs on the stack of the interrupted thread
+    }
+
+    if(cpu->current == cpu->idle || --cpu->current->ticks_left == 0)
+    {
+        schedule();
+    }
+}
+
+/**
+ * @brief First code of a new thread, switch_context() returns here
+ */
+static void thread_start()
+{
+    finish_switch();
+    asm volatile("sti"); // The switch may have happened in the timer interrupt
+
+    struct thread* thread = this_cpu()->current;
+    thread->function(thread->arg);
+    thread_exit();
+}
+
+/**
+ * @brief Run queued or stolen threads, halt until the next interrupt when there are none
+ * Without a timer interrupt on the CPU nothing would wake it, so it keeps polling the other queues instead
+ */
+static void idle_loop()
+{
+    for(;;)
+    {
+        asm volatile("cli");
+        schedule();
+        if(this_cpu()->has_timer)
+        {
+            asm volatile("sti; hlt");
+        }
+        else
+        {
+            asm volatile("sti");
+            cpu_relax();
+        }
+    }
+}
+
+static void idle_thread(void* arg)
+{
+    idle_loop();
+}
+
+// Count a new thread unless there are MAX_THREADS already
+static bool reserve_thread()
+{
+    for(;;)
+    {
+        uint32_t total = total_threads;
+        if(total >= MAX_THREADS)
+        {
+            return false;
+        }
+
+        if(atomic_cmpxchg(&total_threads, total, total + 1))
+        {
+            return true;
+        }
+    }
+}
+
+static struct thread* new_thread(THREAD_FUNCTION function, void* arg, const char* name)
+{
+    struct thread* thread = kmalloc(sizeof(struct thread));
+    if(!thread)
+    {
+        return 0;
+    }
+
+    memset(thread, 0x00, sizeof(struct thread));
+    thread->stack = kmalloc(THREAD_STACK_SIZE);
+    if(!thread->stack)
+    {
+        kfree(thread);
+        return 0;
+    }
+
+    thread->id = atomic_fetch_add(&next_thread_id, 1);
+    thread->function = function;
+    thread->arg = arg;
+    thread->stack_top = (uint32_t)thread->stack + THREAD_STACK_SIZE;
+    int len = strlen(name);
+    len = len < THREAD_NAME_LEN - 1 ? len : THREAD_NAME_LEN - 1;
+    memcpy(thread->name, name, len);
+
+    // The frame switch_context() pops: eflags, edi, esi, ebx, ebp, then it returns to thread_start()
+    uint32_t* sp = (uint32_t*)thread->stack_top;
+    *--sp = 0; // Return address of thread_start(), it never returns
+    *--sp = (uint32_t)thread_start;
+    *--sp = 0; // ebp
+    *--sp = 0; // ebx
+    *--sp = 0; // esi
+    *--sp = 0; // edi
+    *--sp = 0x2; // eflags, interrupts off until thread_start()
+    thread->esp = (uint32_t)sp;
+    return thread;
+}
+
+/**
+ * @brief Turn the boot flow into thread 0 and start preempting it from the timer interrupt
+ * Call on the BSP after smp_init_bsp(), its tss.esp0 is BOOT_THREAD_ESP0 while the boot thread runs
+ */
+void thread_init()
+{
+    struct cpu* cpu = this_cpu();
+    next_thread_id = 1;
+    total_threads = 1;
+
+    memset(&boot_thread, 0x00, sizeof(boot_thread));
+    strcpy(boot_thread.name, "boot");
+    boot_thread.state = THREAD_RUNNING;
+    boot_thread.stack_top = BOOT_THREAD_ESP0;
+    boot_thread.ticks_left = THREAD_TIME_SLICE;
+
+    cpu->idle = new_thread(idle_thread, 0, "idle");
+    if(!cpu->idle)
+    {
+        panic("Failed to create the idle thread\n");
+    }
+
+    cpu->current = &boot_thread;
+    cpu->has_timer = true; // The PIT interrupt reaches the BSP
+    timer_set_handler(scheduler_tick);
+}
+
+/**
+ * @brief Make the boot flow of an AP its idle thread and start running threads on it, never returns
+ */
+void thread_init_ap()
+{
+    struct cpu* cpu = this_cpu();
+    struct thread* idle = kmalloc(sizeof(struct thread));
+    if(!idle)
+    {
+        panic("Failed to create the idle thread\n");
+    }
+
+    memset(idle, 0x00, sizeof(struct thread));
+    idle->id = atomic_fetch_add(&next_thread_id, 1);
+    strcpy(idle->name, "idle");
+    idle->state = THREAD_RUNNING;
+    idle->stack = cpu->stack;
+    idle->stack_top = (uint32_t)cpu->stack + SMP_AP_STACK_SIZE;
+    cpu->idle = idle;
+    cpu->current = idle;
+    idle_loop();
+}
+
+/**
+ * @brief Start a kernel thread on its own THREAD_STACK_SIZE stack, it is queued on the calling CPU
+ * The thread exits when function returns
+ * @return The thread id, -ENOMEM if there are MAX_THREADS threads or the thread can not be allocated
+ */
+int thread_create(THREAD_FUNCTION function, void* arg, const char* name)
+{
+    if(!reserve_thread())
+    {
+        return -ENOMEM;
+    }
+
+    struct thread* thread = new_thread(function, arg, name);
+    if(!thread)
+    {
+        atomic_fetch_add(&total_threads, -1);
+        return -ENOMEM;
+    }
+
+    int id = thread->id;
+    uint32_t flags = irq_save();
+    thread->state = THREAD_READY;
+    run_queue_push(&this_cpu()->run_queue, thread);
+    irq_restore(flags);
+    return id;
+}
+
+struct thread* current_thread()
+{
+    return this_cpu()->current;
+}
+
+/**
+ * @brief Give the rest of the time slice to the next ready thread
+ * Does nothing before thread_init(), so code that polls hardware can always call it
+ */
+void thread_yield()
+{
+    uint32_t flags = irq_save();
+    if(this_cpu()->current)
+    {
+        schedule();
+    }
+    irq_restore(flags);
+}
+
+/**
+ * @brief End the current thread, its stack is freed by the next thread that runs on the CPU
+ */
+void thread_exit()
+{
+    irq_save();
+    struct cpu* cpu = this_cpu();
+    if(cpu->current == &boot_thread || cpu->current == cpu->idle)
+    {
+        panic("The boot and idle threads can not exit\n");
+    }
+
+    cpu->current->state = THREAD_DEAD;
+    cpu->dead = cpu->current;
+    schedule();
+}
+
+void print_sched_stats()
+{
+    for(int i = 0; i < smp_total_cpus(); i++)
+    {
+        struct cpu* cpu = smp_get_cpu(i);
+        print("CPU ");
+        put_int(cpu->id);
+        print(" queued: ");
+        put_uint(run_queue_length(&cpu->run_queue));
+        print(" (max ");
+        put_uint(cpu->stats.max_queued);
+        print("), switches: ");
+        put_uint(cpu->stats.switches);
+        print(", steals: ");
+        put_uint(cpu->stats.steals);
+        print("\n");
+    }
+}
+
+void wait_queue_init(struct wait_queue* queue)
+{
+    queue->lock.locked = 0;
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+/**
+ * @brief Disable interrupts and lock the queue, as wait_event() does before it checks its condition
+ * @return The interrupt flag to give back to wait_queue_unlock()
+ */
+uint32_t wait_queue_lock(struct wait_queue* queue)
+{
+    uint32_t flags = irq_save();
+    spin_lock(&queue->lock);
+    return flags;
+}
+
+void wait_queue_unlock(struct wait_queue* queue, uint32_t flags)
+{
+    spin_unlock(&queue->lock);
+    irq_restore(flags);
+}
+
+/**
+ * @brief Sleep on a locked queue until wake_up(), the queue is locked again on return
+ * The lock is held until the thread is switched out, so no waker queues the thread while its stack is in use
+ * Before thread_init(), on the idle thread and in queued work there is no thread to put to sleep, it just polls
+ */
+void wait_queue_sleep_locked(struct wait_queue* queue)
+{
+    struct cpu* cpu = this_cpu();
+    struct thread* thread = cpu->current;
+    if(!thread || thread == cpu->idle || cpu->in_softirq)
+    {
+        spin_unlock(&queue->lock);
+        cpu_relax();
+        spin_lock(&queue->lock);
+        return;
+    }
+
+    thread->state = THREAD_BLOCKED;
+    thread->wait_next = 0;
+    if(queue->tail)
+    {
+        queue->tail->wait_next = thread;
+    }
+    else
+    {
+        queue->head = thread;
+    }
+    queue->tail = thread;
+
+    cpu->sleep_lock = &queue->lock;
+    schedule(); // Never keeps running a blocked thread, finish_switch() unlocks the queue
+    spin_lock(&queue->lock);
+}
+
+/**
+ * @brief Make every thread sleeping on a locked queue ready, they check their conditions again
+ * The threads are queued on the calling CPU, others steal them if it is busy
+ */
+void wake_up_locked(struct wait_queue* queue)
+{
+    struct thread* thread = queue->head;
+    queue->head = 0;
+    queue->tail = 0;
+
+    struct run_queue* run_queue = &this_cpu()->run_queue;
+    while(thread)
+    {
+        struct thread* next = thread->wait_next;
+        thread->wait_next = 0;
+        thread->state = THREAD_READY;
+        run_queue_push(run_queue, thread); // Can not fail, there are at most MAX_THREADS
+        thread = next;
+    }
+}
+
+/**
+ * @brief Wake every thread sleeping on the queue, safe in interrupt handlers
+ */
+void wake_up(struct wait_queue* queue)
+{
+    uint32_t flags = wait_queue_lock(queue);
+    wake_up_locked(queue);
+    wait_queue_unlock(queue, flags);
+}
+
+void mutex_init(struct mutex* mutex)
+{
+    mutex->locked = 0;
+    mutex->owner = 0;
+    wait_queue_init(&mutex->waiters);
+}
+
+/**
+ * @brief Take the mutex, sleeping while another thread holds it
+ */
+void mutex_lock(struct mutex* mutex)
+{
+    while(atomic_xchg(&mutex->locked, 1))
+    {
+        wait_event(&mutex->waiters, !mutex->locked);
+    }
+
+    mutex->owner = current_thread();
+}
+
+void mutex_unlock(struct mutex* mutex)
+{
+    mutex->owner = 0;
+    asm volatile("" : : : "memory");
+    mutex->locked = 0;
+    wake_up(&mutex->waiters); // Its lock orders the store before the waiters check locked again
+}
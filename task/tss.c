@@ -0,0 +1,10 @@
+#include "tss.h"
+#include "smp.h"
+
+/**
+ * @brief Set the stack the CPU switches to when an interrupt arrives from ring 3, in the TSS of the calling CPU
+ */
+void tss_set_kernel_stack(uint32_t esp0)
+{
+    this_cpu()->tss.esp0 = esp0;
+}
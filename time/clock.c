@@ -0,0 +1,197 @@
+#include "clock.h"
+#include "io.h"
+#include "config.h"
+#include "errno.h"
+#include "interrupt.h"
+
+// Reference: https://wiki.osdev.org/Programmable_Interval_Timer
+#define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_GATE 0x61 // Bit 0 gates channel 2, bit 1 drives the speaker, bit 5 is the output of channel 2
+
+#define PIT_MODE_ONESHOT 0x30 // Channel 0, low then high byte, mode 0(interrupt on terminal count)
+#define PIT_MODE_PERIODIC 0x34 // Channel 0, low then high byte, mode 2(rate generator)
+#define PIT_MODE_CALIBRATE 0xB0 // Channel 2, low then high byte, mode 0
+
+#define CLOCK_SHIFT 22 // ns = cycles * tsc_mult >> CLOCK_SHIFT
+
+static uint32_t tsc_khz;
+static uint32_t tsc_mult; // 0 if the TSC is not used, clock_ns() then counts ticks
+static uint64_t tsc_base;
+static volatile uint32_t ticks;
+static volatile uint32_t tick_ns; // Period of the periodic timer, 0 while it is one-shot
+static volatile uint64_t tick_base_ns; // Time of the ticks counted before the last timer_periodic()
+static TIMER_HANDLER timer_handler;
+static bool local_timers; // The handler runs from the local timer of every CPU, the PIT only keeps time
+
+static bool has_tsc()
+{
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (edx & 0x10) != 0; // CPUID.1:EDX.TSC
+}
+
+/**
+ * @brief Count TSC cycles while PIT channel 2 counts down CLOCK_CALIBRATE_MS
+ * The output of channel 2 is polled through port 0x61, so no interrupt is needed
+ */
+static uint64_t measure_tsc_cycles()
+{
+    uint32_t latch = PIT_FREQUENCY / 1000 * CLOCK_CALIBRATE_MS;
+    outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01); // Gate channel 2 on, speaker off
+    outb(PIT_COMMAND, PIT_MODE_CALIBRATE);
+    outb(PIT_CHANNEL2, latch & 0xFF);
+    outb(PIT_CHANNEL2, latch >> 8); // Counting starts after the high byte
+
+    uint64_t start = read_tsc();
+    while(!(inb(PIT_GATE) & 0x20))
+    {
+    }
+
+    return read_tsc() - start;
+}
+
+/**
+ * @brief Calibrate the TSC against the PIT and start the periodic timer at CLOCK_TICK_HZ
+ * Runs before interrupts are enabled; the shortest of a few rounds is kept, a longer one was disturbed
+ */
+void clock_init()
+{
+    tsc_khz = 0;
+    tsc_mult = 0;
+    if(has_tsc())
+    {
+        uint64_t cycles = measure_tsc_cycles();
+        for(int i = 1; i < CLOCK_CALIBRATE_ROUNDS; i++)
+        {
+            uint64_t round = measure_tsc_cycles();
+            cycles = round < cycles ? round : cycles;
+        }
+
+        uint32_t khz = div64_32(cycles, CLOCK_CALIBRATE_MS);
+        if(khz >= 1000) // Below 1MHz the TSC is not worth using and the multiplier would not fit 32 bits
+        {
+            tsc_khz = khz;
+            tsc_mult = div64_32((uint64_t)1000000 << CLOCK_SHIFT, khz);
+        }
+    }
+
+    tsc_base = read_tsc();
+    local_timers = false;
+    ticks = 0;
+    tick_base_ns = 0;
+    timer_periodic(CLOCK_TICK_HZ);
+}
+
+/**
+ * @brief Convert TSC cycles to nanoseconds
+ */
+uint64_t clock_cycles_to_ns(uint64_t cycles)
+{
+    // Multiply the halves separately so the product can not overflow 64 bits
+    uint64_t high = (cycles >> 32) * tsc_mult;
+    uint64_t low = (cycles & 0xFFFFFFFF) * tsc_mult;
+    return (high << (32 - CLOCK_SHIFT)) + (low >> CLOCK_SHIFT);
+}
+
+/**
+ * @brief Monotonic nanoseconds since clock_init(), read from the TSC without any port I/O
+ * Without a usable TSC it falls back to the resolution of the periodic timer
+ */
+uint64_t clock_ns()
+{
+    if(tsc_mult)
+    {
+        return clock_cycles_to_ns(read_tsc() - tsc_base);
+    }
+
+    return tick_base_ns + (uint64_t)ticks * tick_ns;
+}
+
+uint32_t clock_tsc_khz()
+{
+    return tsc_khz;
+}
+
+// Timer interrupts since clock_init()
+uint32_t clock_ticks()
+{
+    return ticks;
+}
+
+/**
+ * @brief Program PIT channel 0 to interrupt hz times a second
+ */
+void timer_periodic(uint32_t hz)
+{
+    uint32_t divisor = hz ? PIT_FREQUENCY / hz : 0;
+    if(divisor == 0 || divisor > 0xFFFF)
+    {
+        divisor = 0xFFFF; // Slowest rate, about 18.2Hz
+    }
+
+    tick_base_ns += (uint64_t)ticks * tick_ns;
+    ticks = 0;
+    tick_ns = div64_32((uint64_t)divisor * 1000000000, PIT_FREQUENCY);
+    outb(PIT_COMMAND, PIT_MODE_PERIODIC);
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, divisor >> 8);
+}
+
+/**
+ * @brief Program PIT channel 0 for a single interrupt after us microseconds, the periodic timer stops
+ * @return 0 if success, -EINVARG if us is longer than the PIT can count(about 55ms)
+ */
+int timer_oneshot(uint32_t us)
+{
+    uint32_t count = div64_32((uint64_t)us * PIT_FREQUENCY, 1000000);
+    if(count > 0xFFFF)
+    {
+        return -EINVARG;
+    }
+
+    count = count ? count : 1;
+    tick_base_ns += (uint64_t)ticks * tick_ns;
+    ticks = 0;
+    tick_ns = 0;
+    outb(PIT_COMMAND, PIT_MODE_ONESHOT);
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, count >> 8);
+    return 0;
+}
+
+/**
+ * @brief Set the function called on every timer interrupt, after the interrupt controller got its EOI
+ */
+void timer_set_handler(TIMER_HANDLER handler)
+{
+    timer_handler = handler;
+}
+
+/**
+ * @brief Run the handler from timer_local_tick() on every CPU instead of from the PIT interrupt
+ */
+void timer_use_local()
+{
+    local_timers = true;
+}
+
+void timer_interrupt_handler(struct trap_frame* frame)
+{
+    ticks ++;
+    irq_eoi(TIMER_IRQ);
+    if(timer_handler && !local_timers)
+    {
+        timer_handler();
+    }
+}
+
+// Called from the local timer interrupt of a CPU after its EOI
+void timer_local_tick()
+{
+    if(timer_handler)
+    {
+        timer_handler();
+    }
+}